@@ -0,0 +1,52 @@
+# Generates a C++ header embedding the ROM images as constexpr arrays,
+# see the EMBED_ROMS option in CMakeLists.txt
+#
+# usage: cmake -DROM_DIR=<dir> -DOUTPUT=<header> -P EmbedRoms.cmake
+
+set(ROMS "basic.901226-01.bin"
+         "characters.901225-01.bin"
+         "kernal.901227-03.bin")
+
+set(ARRAYS "")
+set(TABLE "")
+set(i 0)
+foreach(rom ${ROMS})
+  file(READ "${ROM_DIR}/${rom}" hex HEX)
+  string(LENGTH "${hex}" len)
+  math(EXPR size "${len} / 2")
+  # 16 bytes per line
+  string(REGEX REPLACE "(................................)" "\\1\n  "
+         bytes "${hex}")
+  string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${bytes}")
+  string(REGEX REPLACE "\n  $" "" bytes "${bytes}")
+  set(ARRAYS "${ARRAYS}constexpr uint8_t kEmbeddedRom${i}[${size}] =\n{\n  ${bytes}\n};\n\n")
+  set(TABLE "${TABLE}  {\"${rom}\", kEmbeddedRom${i}, ${size}},\n")
+  math(EXPR i "${i} + 1")
+endforeach()
+
+file(WRITE "${OUTPUT}.tmp"
+"/* generated by cmake/EmbedRoms.cmake from ${ROM_DIR}, do not edit */
+
+#ifndef EMUDORE_ROMS_H
+#define EMUDORE_ROMS_H
+
+#include <cstdint>
+#include <cstddef>
+
+${ARRAYS}struct EmbeddedAsset
+{
+  const char *name;
+  const uint8_t *data;
+  size_t size;
+};
+
+constexpr EmbeddedAsset kEmbeddedRoms[] =
+{
+${TABLE}};
+
+#endif
+")
+# only touch the header if it changed
+execute_process(COMMAND ${CMAKE_COMMAND} -E copy_if_different
+  "${OUTPUT}.tmp" "${OUTPUT}")
+file(REMOVE "${OUTPUT}.tmp")
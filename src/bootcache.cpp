@@ -0,0 +1,89 @@
+/*
+ * emudore, Commodore 64 emulator
+ * Copyright (c) 2016, Mario Ballano <mballano@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdio>
+#include "bootcache.h"
+#include "rom.h"
+
+std::mutex BootCache::lock_;
+std::unordered_map<uint64_t,std::shared_ptr<C64::State>> BootCache::states_;
+std::string BootCache::dir_;
+
+/**
+ * @brief sets the directory where snapshots are persisted
+ *
+ * Empty (the default) keeps them in memory only.
+ */
+void BootCache::directory(const std::string &d)
+{
+  std::lock_guard<std::mutex> l(lock_);
+  dir_ = d;
+}
+
+std::string BootCache::file(uint64_t hash)
+{
+  char name[32];
+  snprintf(name,sizeof(name),"boot-%016llx.state",(unsigned long long)hash);
+  return dir_ + "/" + name;
+}
+
+/**
+ * @brief restores the post-boot snapshot for the current ROM set
+ *
+ * Returns false if there is none yet.
+ */
+bool BootCache::restore(C64 *c64)
+{
+  uint64_t hash = Rom::shared().hash();
+  std::shared_ptr<C64::State> s;
+  {
+    std::lock_guard<std::mutex> l(lock_);
+    auto it = states_.find(hash);
+    if(it != states_.end())
+      s = it->second;
+    else if(!dir_.empty() && c64->load_state(file(hash)))
+    {
+      /* keep it in memory for the next machines */
+      s = std::make_shared<C64::State>();
+      c64->save_state(s.get());
+      states_[hash] = s;
+      return true;
+    }
+  }
+  return s && c64->load_state(*s);
+}
+
+/**
+ * @brief captures the snapshot from a machine that just booted
+ */
+void BootCache::store(C64 *c64)
+{
+  uint64_t hash = Rom::shared().hash();
+  std::shared_ptr<C64::State> s = std::make_shared<C64::State>();
+  c64->save_state(s.get());
+  std::lock_guard<std::mutex> l(lock_);
+  if(states_.count(hash))
+    return;
+  states_[hash] = s;
+  /* written aside then renamed, other processes may be reading it */
+  if(!dir_.empty())
+  {
+    std::string f = file(hash);
+    if(c64->save_state(f + ".tmp"))
+      std::rename((f + ".tmp").c_str(),f.c_str());
+  }
+}
@@ -0,0 +1,53 @@
+/*
+ * emudore, Commodore 64 emulator
+ * Copyright (c) 2016, Mario Ballano <mballano@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMUDORE_BOOTCACHE_H
+#define EMUDORE_BOOTCACHE_H
+
+#include <mutex>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "c64.h"
+
+/**
+ * @brief post-boot machine snapshots, keyed by ROM set
+ *
+ * Holds the state of a machine that went through the KERNAL cold 
+ * start and is idling at the BASIC prompt, so other machines with the
+ * same ROMs (see Rom::hash()) can skip it, see Loader::warm_boot().
+ *
+ * Snapshots are kept in memory for the process lifetime and, if a 
+ * directory is set, on disk so later processes reuse them.
+ *
+ * Thread safe.
+ */
+class BootCache
+{
+  private:
+    static std::mutex lock_;
+    static std::unordered_map<uint64_t,std::shared_ptr<C64::State>> states_;
+    static std::string dir_;
+    static std::string file(uint64_t hash);
+  public:
+    static bool restore(C64 *c64);
+    static void store(C64 *c64);
+    static void directory(const std::string &d);
+};
+
+#endif
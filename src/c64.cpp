@@ -14,10 +14,12 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <algorithm>
+#include <fstream>
 #include "c64.h"
 #include "util.h"
 
-C64::C64()
+C64::C64(Sink *sink)
 {
   /* create chips */
   cpu_  = new Cpu();
@@ -26,7 +28,8 @@ C64::C64()
   cia2_ = new Cia2();
   vic_  = new Vic();
   sid_  = new Sid();
-  io_   = new IO();
+  io_   = new IO(sink);
+  next_observer_ = 1;
   /* init cpu */
   cpu_->memory(mem_);
   cpu_->reset();
@@ -39,6 +42,7 @@ C64::C64()
   cia1_->io(io_);
   /* init cia2 */
   cia2_->cpu(cpu_);
+  cia2_->memory(mem_);
   /* init io */
   io_->cpu(cpu_);
   /* DMA */
@@ -67,59 +71,190 @@ C64::~C64()
 #endif   
 }
 
-void C64::start()
+/**
+ * @brief cycles left until the earliest chip event
+ */
+int C64::next_event()
+{
+  int next = vic_->next_event();
+  next = std::min(next,cia1_->next_event());
+  next = std::min(next,cia2_->next_event());
+  next = std::min(next,io_->next_event());
+  return std::max(next,0);
+}
+
+/**
+ * @brief runs the CPU until the earliest chip event is due
+ *
+ * Chips may pull in the deadline while the CPU is running 
+ * (see Cpu::schedule()). At least one instruction is run even if an
+ * event is already due, so a chip that keeps asking to be serviced 
+ * right away (e.g. a CIA timer with a zero latch) can't stall it.
+ */
+bool C64::run_cpu()
+{
+  Cpu::RunResult r = cpu_->run(std::max(next_event(),1));
+  return r.reason != Cpu::kStopIllegal;
+}
+
+/**
+ * @brief one iteration of the main emulator loop
+ *
+ * Returns false if any component asks to stop
+ */
+bool C64::step()
 {
-  /* main emulator loop */
-  while(true)
-  {
 #ifdef DEBUGGER_SUPPORT
-    if(!debugger_->emulate())
-      break;
+  if(!debugger_->emulate())
+    return false;
 #endif
-    /* CIA1 */
-    if(!cia1_->emulate())
-      break;
-    /* CIA2 */
-    if(!cia2_->emulate())
-      break;
-    /* CPU */
-    if(!cpu_->emulate())
-      break;
-    /* VIC-II */
-    if(!vic_->emulate())
-      break;
-    /* IO */
-    if(!io_->emulate())
-      break;
-    /* callback */
-    if(callback_ && !callback_())
-      break;
+  /* CIA1 */
+  if(!cia1_->emulate())
+    return false;
+  /* CIA2 */
+  if(!cia2_->emulate())
+    return false;
+  /* CPU */
+  if(!run_cpu())
+    return false;
+  /* VIC-II */
+  unsigned int frame = vic_->frames();
+  if(!vic_->emulate())
+    return false;
+  /* frame observers, run once the VIC-II completes a frame */
+  if(frame != vic_->frames())
+  {
+    for(size_t i=0 ; i < frame_observers_.size() ; i++)
+      frame_observers_[i].second();
   }
+  /* IO */
+  if(!io_->emulate())
+    return false;
+  /* callback, runs whenever the CPU stops */
+  if(callback_ && !callback_())
+    return false;
+  return true;
 }
 
 /**
- * @brief emscripten's main loop
+ * @brief runs until the VIC-II completes a frame
+ *
+ * Returns false if any component asks to stop
  */
-void C64::emscripten_loop()
+bool C64::run_frame()
 {
   unsigned int frame = vic_->frames();
   while(frame == vic_->frames())
   {
-    /* CIA1 */
-    cia1_->emulate();
-    /* CIA2 */
-    cia2_->emulate();
-    /* CPU */
-    cpu_->emulate();
-    /* VIC-II */
-    vic_->emulate();
-    /* IO */
-    io_->emulate();
-    /* callback */
-    if(callback_) callback_();
+    if(!step())
+      return false;
+  }
+  return true;
+}
+
+void C64::start()
+{
+  /* main emulator loop */
+  while(step());
+}
+
+/**
+ * @brief emscripten's main loop
+ */
+void C64::emscripten_loop()
+{
+  run_frame();
+}
+
+/**
+ * @brief calls cb whenever the VIC-II completes a frame
+ *
+ * Observers run in the order they were added, the returned id removes
+ * it again. They may not add or remove observers themselves.
+ */
+unsigned int C64::add_frame_observer(std::function<void()> cb)
+{
+  frame_observers_.push_back(std::make_pair(next_observer_,cb));
+  return next_observer_++;
+}
+
+void C64::remove_frame_observer(unsigned int id)
+{
+  for(auto it=frame_observers_.begin() ; it != frame_observers_.end() ; ++it)
+  {
+    if(it->first == id)
+    {
+      frame_observers_.erase(it);
+      break;
+    }
   }
 }
  
+// save states ///////////////////////////////////////////////////////////////
+
+/**
+ * @brief saves the state of every chip into s
+ *
+ * Cheap enough to be done every frame, s can be reused.
+ */
+void C64::save_state(State *s)
+{
+  s->magic = kStateMagic;
+  s->version = kStateVersion;
+  s->size = sizeof(State);
+  cpu_->save(&s->cpu);
+  mem_->save(&s->mem);
+  cia1_->save(&s->cia1);
+  cia2_->save(&s->cia2);
+  vic_->save(&s->vic);
+  io_->save(&s->io);
+}
+
+/**
+ * @brief restores a state saved with save_state()
+ *
+ * Returns false, leaving the machine untouched, if s was saved by an 
+ * incompatible build.
+ */
+bool C64::load_state(const State &s)
+{
+  if(s.magic != kStateMagic || s.version != kStateVersion ||
+     s.size != sizeof(State))
+    return false;
+  cpu_->load(s.cpu);
+  mem_->load(s.mem);
+  cia1_->load(s.cia1);
+  cia2_->load(s.cia2);
+  vic_->load(s.vic);
+  io_->load(s.io);
+  return true;
+}
+
+/**
+ * @brief saves the machine state to a file
+ */
+bool C64::save_state(const std::string &f)
+{
+  State *s = new State();
+  save_state(s);
+  std::ofstream os(f, std::ios::out | std::ios::binary);
+  os.write((const char *)s,sizeof(State));
+  delete s;
+  return os.good();
+}
+
+/**
+ * @brief loads the machine state from a file
+ */
+bool C64::load_state(const std::string &f)
+{
+  std::ifstream is(f, std::ios::in | std::ios::binary);
+  State *s = new State();
+  bool retval = is.read((char *)s,sizeof(State)) && load_state(*s);
+  delete s;
+  return retval;
+}
+
 /**
  * @brief runs Klaus Dormann's 6502 test suite 
  *
@@ -127,26 +262,29 @@ void C64::emscripten_loop()
  */
 void C64::test_cpu()
 {
-  uint16_t pc=0;
   /* unmap C64 ROMs */
   mem_->write_byte(Memory::kAddrMemoryLayout, 0);
   /* load tests into RAM */
   mem_->load_ram("tests/6502_functional_test.bin",0x400);
   cpu_->pc(0x400);
+  cpu_->breakpoint(0x3463);
+  cpu_->stop_on_trap(true);
   while(true)
   {
-    if(pc == cpu_->pc())
+    Cpu::RunResult r = cpu_->run(kTestBudget);
+    if(r.reason == Cpu::kStopTrap)
     {
-      D("infinite loop at %x\n",pc);
+      D("infinite loop at %x\n",cpu_->pc());
       break;
     }
-    else if(cpu_->pc() == 0x3463)
+    else if(r.reason == Cpu::kStopBreakpoint)
     {
       D("test passed!\n");
       break;
     }
-    pc = cpu_->pc();
-    if(!cpu_->emulate())
+    else if(r.reason == Cpu::kStopIllegal)
       break;
   }
+  cpu_->breakpoint(Cpu::kNoBreakpoint);
+  cpu_->stop_on_trap(false);
 }
@@ -18,6 +18,8 @@
 #ifndef EMUDORE_C64_H
 #define EMUDORE_C64_H
 
+#include <string>
+#include <vector>
 #include <functional>
 
 #include "cpu.h"
@@ -37,6 +39,9 @@
  * 
  * This class glues together all the different
  * components in a Commodore 64 computer
+ *
+ * Frames and host input go through the given Sink, the machine 
+ * runs headless if none is given.
  */
 class C64
 {
@@ -49,20 +54,56 @@ class C64
     Sid *sid_;
     IO *io_;
     std::function<bool()> callback_;
+    /* run once the VIC-II completes a frame, see add_frame_observer() */
+    std::vector<std::pair<unsigned int,std::function<void()>>> frame_observers_;
+    unsigned int next_observer_;
 #ifdef DEBUGGER_SUPPORT
     Debugger *debugger_;
 #endif
+    int next_event();
+    bool run_cpu();
   public:
-    C64();
+    C64(Sink *sink = nullptr);
     ~C64();
+    bool step();
+    bool run_frame();
     void start();
     void emscripten_loop();
     void callback(std::function<bool()> cb){callback_ = cb;};
+    unsigned int add_frame_observer(std::function<void()> cb);
+    void remove_frame_observer(unsigned int id);
     Cpu * cpu(){return cpu_;};
     Memory * memory(){return mem_;};
     IO * io(){return io_;};
+    Vic * vic(){return vic_;};
+    /**
+     * @brief save state of the whole machine
+     *
+     * Plain data, saving or loading is a copy per chip, the blob is 
+     * only portable between builds with the same layout (checked 
+     * through kStateVersion and the size).
+     */
+    struct State
+    {
+      uint32_t magic;
+      uint32_t version;
+      uint32_t size;
+      Cpu::State cpu;
+      Memory::State mem;
+      Cia1::State cia1;
+      Cia2::State cia2;
+      Vic::State vic;
+      IO::State io;
+    };
+    void save_state(State *s);
+    bool load_state(const State &s);
+    bool save_state(const std::string &f);
+    bool load_state(const std::string &f);
+    static const uint32_t kStateMagic = 0x34364345; /* "EC64" */
+    static const uint32_t kStateVersion = 2;
     /* test cpu */
     void test_cpu();
+    static const unsigned int kTestBudget = 1000000;
 };
 
 #endif
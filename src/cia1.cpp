@@ -15,6 +15,7 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include "cia1.h"
 
 // ctor  /////////////////////////////////////////////////////////////////////
@@ -34,6 +35,7 @@ Cia1::Cia1()
 
 void Cia1::write_register(uint8_t r, uint8_t v)
 {
+  sync_timers();
   switch(r)
   {
   /* data port a (PRA), keyboard matrix cols and joystick #2 */
@@ -110,11 +112,14 @@ void Cia1::write_register(uint8_t r, uint8_t v)
       timer_b_counter_ = timer_b_latch_;
     break;
   }
+  /* a timer may have been started or reloaded */
+  cpu_->schedule(next_event());
 }
 
 uint8_t Cia1::read_register(uint8_t r)
 {
   uint8_t retval = 0;
+  sync_timers();
 
   switch(r)
   {
@@ -221,13 +226,13 @@ void Cia1::reset_timer_b()
 
 bool Cia1::emulate()
 {
+  sync_timers();
   /* timer a */
   if(timer_a_enabled_)
   {
     switch(timer_a_input_mode_)
     {
     case kModeProcessor:
-      timer_a_counter_ -= cpu_->cycles() - prev_cpu_cycles_;
       if (timer_a_counter_ <= 0)
       {
         if(timer_a_irq_enabled_) 
@@ -248,7 +253,6 @@ bool Cia1::emulate()
     switch(timer_b_input_mode_)
     {
     case kModeProcessor:
-      timer_b_counter_ -= cpu_->cycles() - prev_cpu_cycles_;
       if (timer_b_counter_ <= 0)
       {
         if(timer_b_irq_enabled_)
@@ -270,3 +274,84 @@ bool Cia1::emulate()
   prev_cpu_cycles_ = cpu_->cycles();
   return true;
 }
+
+/**
+ * @brief brings the timer counters up to date
+ *
+ * The chip is only serviced when one of its events is due, timers
+ * are caught up with the CPU clock before they are checked, read 
+ * or reprogrammed.
+ */
+void Cia1::sync_timers()
+{
+  unsigned int elapsed = cpu_->cycles() - prev_cpu_cycles_;
+  if(timer_a_enabled_ && timer_a_input_mode_ == kModeProcessor)
+    timer_a_counter_ -= elapsed;
+  if(timer_b_enabled_ && timer_b_input_mode_ == kModeProcessor)
+    timer_b_counter_ -= elapsed;
+  prev_cpu_cycles_ = cpu_->cycles();
+}
+
+/**
+ * @brief cycles left until the next timer underflow
+ */
+int Cia1::next_event()
+{
+  int next = Cpu::kNoEvent;
+  int elapsed = cpu_->cycles() - prev_cpu_cycles_;
+  if(timer_a_enabled_ && timer_a_input_mode_ == kModeProcessor)
+    next = std::min(next,timer_a_counter_ - elapsed);
+  if(timer_b_enabled_ && timer_b_input_mode_ == kModeProcessor)
+    next = std::min(next,timer_b_counter_ - elapsed);
+  return next;
+}
+
+// save states ///////////////////////////////////////////////////////////////
+
+/**
+ * @brief copies the chip state out, see C64::save_state()
+ */
+void Cia1::save(State *s)
+{
+  s->timer_a_latch = timer_a_latch_;
+  s->timer_b_latch = timer_b_latch_;
+  s->timer_a_counter = timer_a_counter_;
+  s->timer_b_counter = timer_b_counter_;
+  s->timer_a_enabled = timer_a_enabled_;
+  s->timer_b_enabled = timer_b_enabled_;
+  s->timer_a_irq_enabled = timer_a_irq_enabled_;
+  s->timer_b_irq_enabled = timer_b_irq_enabled_;
+  s->timer_a_irq_triggered = timer_a_irq_triggered_;
+  s->timer_b_irq_triggered = timer_b_irq_triggered_;
+  s->timer_a_run_mode = timer_a_run_mode_;
+  s->timer_b_run_mode = timer_b_run_mode_;
+  s->timer_a_input_mode = timer_a_input_mode_;
+  s->timer_b_input_mode = timer_b_input_mode_;
+  s->prev_cpu_cycles = prev_cpu_cycles_;
+  s->pra = pra_;
+  s->prb = prb_;
+}
+
+/**
+ * @brief restores a state saved with save()
+ */
+void Cia1::load(const State &s)
+{
+  timer_a_latch_ = s.timer_a_latch;
+  timer_b_latch_ = s.timer_b_latch;
+  timer_a_counter_ = s.timer_a_counter;
+  timer_b_counter_ = s.timer_b_counter;
+  timer_a_enabled_ = s.timer_a_enabled;
+  timer_b_enabled_ = s.timer_b_enabled;
+  timer_a_irq_enabled_ = s.timer_a_irq_enabled;
+  timer_b_irq_enabled_ = s.timer_b_irq_enabled;
+  timer_a_irq_triggered_ = s.timer_a_irq_triggered;
+  timer_b_irq_triggered_ = s.timer_b_irq_triggered;
+  timer_a_run_mode_ = s.timer_a_run_mode;
+  timer_b_run_mode_ = s.timer_b_run_mode;
+  timer_a_input_mode_ = s.timer_a_input_mode;
+  timer_b_input_mode_ = s.timer_b_input_mode;
+  prev_cpu_cycles_ = s.prev_cpu_cycles;
+  pra_ = s.pra;
+  prb_ = s.prb;
+}
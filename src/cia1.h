@@ -31,10 +31,11 @@ class Cia1
   private:
     Cpu *cpu_;
     IO *io_;
-    int16_t timer_a_latch_;
-    int16_t timer_b_latch_;
-    int16_t timer_a_counter_;
-    int16_t timer_b_counter_;
+    uint16_t timer_a_latch_;
+    uint16_t timer_b_latch_;
+    /* 0-65535 while counting, zero or below once it underflows */
+    int timer_a_counter_;
+    int timer_b_counter_;
     bool timer_a_enabled_;
     bool timer_b_enabled_;
     bool timer_a_irq_enabled_;
@@ -55,7 +56,31 @@ class Cia1
     uint8_t read_register(uint8_t r);
     void reset_timer_a();
     void reset_timer_b();
+    void sync_timers();
     bool emulate();
+    int next_event();
+    /* save states */
+    struct State
+    {
+      uint16_t timer_a_latch;
+      uint16_t timer_b_latch;
+      int timer_a_counter;
+      int timer_b_counter;
+      bool timer_a_enabled;
+      bool timer_b_enabled;
+      bool timer_a_irq_enabled;
+      bool timer_b_irq_enabled;
+      bool timer_a_irq_triggered;
+      bool timer_b_irq_triggered;
+      uint8_t timer_a_run_mode;
+      uint8_t timer_b_run_mode;
+      uint8_t timer_a_input_mode;
+      uint8_t timer_b_input_mode;
+      unsigned int prev_cpu_cycles;
+      uint8_t pra, prb;
+    };
+    void save(State *s);
+    void load(const State &s);
     /* constants */
     enum kInputMode
     {
@@ -30,10 +30,12 @@ class Cia2
 {
   private:
     Cpu *cpu_;
-    int16_t timer_a_latch_;
-    int16_t timer_b_latch_;
-    int16_t timer_a_counter_;
-    int16_t timer_b_counter_;
+    Memory *mem_;
+    uint16_t timer_a_latch_;
+    uint16_t timer_b_latch_;
+    /* 0-65535 while counting, zero or below once it underflows */
+    int timer_a_counter_;
+    int timer_b_counter_;
     bool timer_a_enabled_;
     bool timer_b_enabled_;
     bool timer_a_irq_enabled_;
@@ -49,12 +51,37 @@ class Cia2
   public:
     Cia2();
     void cpu(Cpu *v){ cpu_ = v;};
+    void memory(Memory *v){ mem_ = v;};
     void write_register(uint8_t r, uint8_t v);
     uint8_t read_register(uint8_t r);
     void reset_timer_a();
     void reset_timer_b();
+    void sync_timers();
     uint16_t vic_base_address();
     bool emulate();
+    int next_event();
+    /* save states */
+    struct State
+    {
+      uint16_t timer_a_latch;
+      uint16_t timer_b_latch;
+      int timer_a_counter;
+      int timer_b_counter;
+      bool timer_a_enabled;
+      bool timer_b_enabled;
+      bool timer_a_irq_enabled;
+      bool timer_b_irq_enabled;
+      bool timer_a_irq_triggered;
+      bool timer_b_irq_triggered;
+      uint8_t timer_a_run_mode;
+      uint8_t timer_b_run_mode;
+      uint8_t timer_a_input_mode;
+      uint8_t timer_b_input_mode;
+      unsigned int prev_cpu_cycles;
+      uint8_t pra, prb;
+    };
+    void save(State *s);
+    void load(const State &s);
     /* constants */
     enum kInputMode
     {
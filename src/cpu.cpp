@@ -18,6 +18,27 @@
 #include "cpu.h"
 #include "util.h"
 #include <sstream>
+#if defined(CPU_JIT)
+#include "jit.h"
+#endif
+
+Cpu::Cpu()
+{
+  blocks_ = new Block[kBlockCacheSize]();
+  scratch_.count = 0;
+  op_ = &scratch_.ops[0];
+#if defined(CPU_JIT)
+  jit_ = new Jit(this);
+#endif
+}
+
+Cpu::~Cpu()
+{
+#if defined(CPU_JIT)
+  delete jit_;
+#endif
+  delete [] blocks_;
+}
 
 /**
  * @brief Cold reset
@@ -27,9 +48,181 @@
 void Cpu::reset()
 {
   a_ = x_ = y_ = sp_ = 0;
-  cf_ = zf_ = idf_ = dmf_ = bcf_ = of_ = nf_ = false;
+  p_ = 0;
+  nz_ = 1;
   pc(mem_->read_word(Memory::kAddrResetVector));
   cycles_ = 6;
+  deadline_ = cycles_;
+  stop_reason_ = kStopBudget;
+  breakpoint_ = kNoBreakpoint;
+  stop_on_trap_ = irq_line_ = false;
+}
+
+/**
+ * @brief run instructions until the cycle budget is used up
+ * @return why the CPU stopped and the number of cycles consumed
+ *
+ * Instructions are never split, so the budget might be exceeded by 
+ * a few cycles, callers stepping for an exact number of cycles should 
+ * carry the excess over to the next call. Execution stops early if:
+ *
+ * - An interrupt line changes state (see irq_line())
+ * - stop() is called, e.g. from a chip register access
+ * - The PC reaches the breakpoint, if one is set
+ * - An instruction jumps to itself, if stop_on_trap() is enabled
+ * - An unknown or illegal instruction is found
+ *
+ * Pending interrupts are serviced before every instruction. Code is 
+ * executed from decoded blocks (see lookup_block()), a block is left 
+ * early whenever an interrupt is pending or a write invalidates it.
+ */
+Cpu::RunResult Cpu::run(unsigned int budget)
+{
+  unsigned int start = cycles_;
+  deadline_ = cycles_ + budget;
+  stop_reason_ = kStopBudget;
+  Block *block;
+  uint8_t page;
+#if defined(CPU_DISPATCH_THREADED)
+  /**
+   * threaded dispatch (GCC and Clang labels as values)
+   *
+   * Rather than looping back to a single indirect jump every handler 
+   * checks the stop conditions and jumps straight to the next one, 
+   * this gives the branch predictor one jump per opcode to learn.
+   */
+  static void * const kLabels[256] = {
+#define OPCODE(op,len,e) &&op_##op,
+#define ILLEGAL(op)      &&illegal,
+#include "opcodes.h"
+#undef OPCODE
+#undef ILLEGAL
+  };
+  uint16_t pc;
+  const MicroOp *end;
+#define FETCH()                                   \
+  pc = pc_;                                       \
+  pc_ += op_->len;                                \
+  goto *kLabels[op_->opcode]
+#define DISPATCH()                                \
+  if(pc_ == breakpoint_)                          \
+  {                                               \
+    stop_reason_ = kStopBreakpoint;               \
+    goto done;                                    \
+  }                                               \
+  if(pc_ == pc && stop_on_trap_)                  \
+  {                                               \
+    stop_reason_ = kStopTrap;                     \
+    goto done;                                    \
+  }                                               \
+  if((int)(cycles_ - deadline_) >= 0)             \
+    goto done;                                    \
+  if(++op_ == end ||                              \
+     block->gen != mem_->code_generation(page) || \
+     (irq_line_ && !idf()))                       \
+    goto lookup;                                  \
+  FETCH()
+lookup:
+  if((int)(cycles_ - deadline_) >= 0)
+    goto done;
+  if(irq_line_ && !idf())
+    irq();
+  block = lookup_block(pc_);
+#if defined(CPU_JIT)
+  if(run_native(block))
+  {
+    if(pc_ == breakpoint_)
+    {
+      stop_reason_ = kStopBreakpoint;
+      goto done;
+    }
+    goto lookup;
+  }
+#endif
+  page = block->pc >> 8;
+  op_ = block->ops;
+  end = op_ + block->count;
+  FETCH();
+#define OPCODE(op,len,e) op_##op: e; DISPATCH();
+#define ILLEGAL(op)
+#include "opcodes.h"
+#undef OPCODE
+#undef ILLEGAL
+#undef DISPATCH
+#undef FETCH
+illegal:
+  illegal(op_->opcode);
+  stop_reason_ = kStopIllegal;
+done:
+#else
+  while((int)(cycles_ - deadline_) < 0)
+  {
+    if(irq_line_ && !idf()) 
+      irq();
+    block = lookup_block(pc_);
+#if defined(CPU_JIT)
+    if(run_native(block))
+    {
+      if(pc_ == breakpoint_)
+      {
+        stop_reason_ = kStopBreakpoint;
+        break;
+      }
+      continue;
+    }
+#endif
+    page = block->pc >> 8;
+    for(op_ = block->ops ; op_ != block->ops + block->count ; op_++)
+    {
+      uint16_t pc = pc_;
+      if(!execute())
+      {
+        stop_reason_ = kStopIllegal;
+        goto done;
+      }
+      if(pc_ == breakpoint_)
+      {
+        stop_reason_ = kStopBreakpoint;
+        goto done;
+      }
+      if(pc_ == pc && stop_on_trap_)
+      {
+        stop_reason_ = kStopTrap;
+        goto done;
+      }
+      if((int)(cycles_ - deadline_) >= 0 ||
+         block->gen != mem_->code_generation(page) ||
+         (irq_line_ && !idf()))
+        break;
+    }
+  }
+done:
+#endif
+  RunResult r = {(kStopReason)stop_reason_, cycles_ - start};
+  return r;
+}
+
+/**
+ * @brief stop run() after the current instruction
+ */
+void Cpu::stop(kStopReason r)
+{
+  stop_reason_ = r;
+  deadline_ = cycles_;
+}
+
+/**
+ * @brief schedule a chip event
+ *
+ * Chips call this when a register write makes them need servicing
+ * earlier than the deadline the CPU is currently running towards,
+ * v is the number of cycles from now, deadlines are never pushed 
+ * further away.
+ */
+void Cpu::schedule(int v)
+{
+  if((int)(cycles_ + v - deadline_) < 0)
+    deadline_ = cycles_ + v;
 }
 
 /** 
@@ -44,322 +237,202 @@ void Cpu::reset()
  */
 bool Cpu::emulate()
 {
-  /* fetch instruction */
-  uint8_t insn = fetch_op();
+  decode(pc_,&scratch_.ops[0]);
+  op_ = &scratch_.ops[0];
+  return execute();
+}
+
+/**
+ * @brief execute the decoded instruction op_ points to
+ */
+bool Cpu::execute()
+{
+  pc_ += op_->len;
+#if defined(CPU_DISPATCH_TABLE)
+  return (this->*kDispatchTable[op_->opcode])();
+#else
   bool retval = true;
   /* emulate instruction */
+  switch(op_->opcode)
+  {
+#define OPCODE(op,len,e) case op: e; break;
+#define ILLEGAL(op)      case op: retval = illegal(op); break;
+#include "opcodes.h"
+#undef OPCODE
+#undef ILLEGAL
+  }
+  return retval;
+#endif
+}
+
+/**
+ * @brief unknown or illegal instruction
+ */
+bool Cpu::illegal(uint8_t insn)
+{
+  D("Unknown instruction: %X at %04x\n", insn,pc());
+  return false;
+}
+
+#if defined(CPU_DISPATCH_TABLE)
+
+/**
+ * @brief function pointer dispatch
+ *
+ * Portable fallback for compilers lacking computed gotos, every 
+ * opcode gets its own handler and execute() calls through a table.
+ */
+#define OPCODE(op,len,e) bool Cpu::op_##op(){e; return true;}
+#define ILLEGAL(op)      bool Cpu::op_##op(){return illegal(op);}
+#include "opcodes.h"
+#undef OPCODE
+#undef ILLEGAL
+
+const Cpu::OpHandler Cpu::kDispatchTable[256] = {
+#define OPCODE(op,len,e) &Cpu::op_##op,
+#define ILLEGAL(op)      &Cpu::op_##op,
+#include "opcodes.h"
+#undef OPCODE
+#undef ILLEGAL
+};
+
+#endif
+
+// decoding //////////////////////////////////////////////////////////////////
+
+const uint8_t Cpu::kInsnLength[256] = {
+#define OPCODE(op,len,e) len,
+#define ILLEGAL(op)      1,
+#include "opcodes.h"
+#undef OPCODE
+#undef ILLEGAL
+};
+
+/**
+ * @brief instructions that can change the PC end a decoded block
+ */
+static inline bool ends_block(uint8_t insn)
+{
   switch(insn)
   {
-  /* BRK */
-  case 0x0: brk(); break;
-  /* ORA (nn,X) */
-  case 0x1: ora(load_byte(addr_indx()),6); break;
-  /* ORA nn */
-  case 0x5: ora(load_byte(addr_zero()),3); break;
-  /* ASL nn */
-  case 0x6: asl_mem(addr_zero(),5); break;
-  /* PHP */
-  case 0x8: php(); break;
-  /* ORA #nn */
-  case 0x9: ora(fetch_op(),2); break;
-  /* ASL A */
-  case 0xA: asl_a(); break;
-  /* ORA nnnn */
-  case 0xD: ora(load_byte(addr_abs()),4); break;
-  /* ASL nnnn */
-  case 0xE: asl_mem(addr_abs(),6); break; 
-  /* BPL nn */
-  case 0x10: bpl(); break;
-  /* ORA (nn,Y) */
-  case 0x11: ora(load_byte(addr_indy()),5); break;
-  /* ORA nn,X */
-  case 0x15: ora(load_byte(addr_zerox()),4); break;
-  /* ASL nn,X */
-  case 0x16: asl_mem(addr_zerox(),6); break;
-  /* CLC */
-  case 0x18: clc(); break;
-  /* ORA nnnn,Y */
-  case 0x19: ora(load_byte(addr_absy()),4); break;
-  /* ORA nnnn,X */
-  case 0x1D: ora(load_byte(addr_absx()),4); break;
-  /* ASL nnnn,X */
-  case 0x1E: asl_mem(addr_absx(),7); break;
-  /* JSR */
-  case 0x20: jsr(); break;
-  /* AND (nn,X) */
-  case 0x21: _and(load_byte(addr_indx()),6); break;
-  /* BIT nn */
-  case 0x24: bit(addr_zero(),3); break;
-  /* AND nn */
-  case 0x25: _and(load_byte(addr_zero()),3); break;
-  /* ROL nn */
-  case 0x26: rol_mem(addr_zero(),5); break;
-  /* PLP */
-  case 0x28: plp(); break;
-  /* AND #nn */
-  case 0x29: _and(fetch_op(),2); break;
-  /* ROL A */
-  case 0x2A: rol_a(); break;
-  /* BIT nnnn */
-  case 0x2C: bit(addr_abs(),4); break;
-  /* AND nnnn */
-  case 0x2D: _and(load_byte(addr_abs()),4); break;
-  /* ROL nnnn */
-  case 0x2E: rol_mem(addr_abs(),6); break;
-  /* BMI nn */
-  case 0x30: bmi(); break;
-  /* AND (nn,Y) */
-  case 0x31: _and(load_byte(addr_indy()),5); break;               
-  /* AND nn,X */
-  case 0x35: _and(load_byte(addr_zerox()),4); break;
-  /* ROL nn,X */
-  case 0x36: rol_mem(addr_zerox(),6); break;
-  /* SEC */
-  case 0x38: sec(); break;
-  /* AND nnnn,Y */
-  case 0x39: _and(load_byte(addr_absy()),4); break;
-  /* AND nnnn,X */
-  case 0x3D: _and(load_byte(addr_absx()),4); break;
-  /* ROL nnnn,X */
-  case 0x3E: rol_mem(addr_absx(),7); break;
-  /* RTI */
-  case 0x40: rti(); break;
-  /* EOR (nn,X) */
-  case 0x41: eor(load_byte(addr_indx()),6); break;
-  /* EOR nn */
-  case 0x45: eor(load_byte(addr_zero()),3); break;
-  /* LSR nn */
-  case 0x46: lsr_mem(addr_zero(),5); break;
-  /* PHA */
-  case 0x48: pha(); break;
-  /* EOR #nn */
-  case 0x49: eor(fetch_op(),2); break;
-  /* BVC */
-  case 0x50: bvc(); break;
-  /* JMP nnnn */
-  case 0x4C: jmp(); break;
-  /* EOR nnnn */
-  case 0x4D: eor(load_byte(addr_abs()),4); break;
-  /* LSR A */
-  case 0x4A: lsr_a(); break;
-  /* LSR nnnn */
-  case 0x4E: lsr_mem(addr_abs(),6); break;
-  /* EOR (nn,Y) */
-  case 0x51: eor(load_byte(addr_indy()),5); break;
-  /* EOR nn,X */
-  case 0x55: eor(load_byte(addr_zerox()),4); break;
-  /* LSR nn,X */
-  case 0x56: lsr_mem(addr_zerox(),6); break;
-  /* CLI */
-  case 0x58: cli(); break;
-  /* EOR nnnn,Y */
-  case 0x59: eor(load_byte(addr_absy()),4); break;
-  /* EOR nnnn,X */
-  case 0x5D: eor(load_byte(addr_absx()),4); break;
-  /* LSR nnnn,X */
-  case 0x5E: lsr_mem(addr_absx(),7); break;
-  /* RTS */
-  case 0x60: rts(); break;
-  /* ADC (nn,X) */
-  case 0x61: adc(load_byte(addr_indx()),6); break;
-  /* ADC nn */
-  case 0x65: adc(load_byte(addr_zero()),3); break;
-  /* ROR nn */
-  case 0x66: ror_mem(addr_zero(),5); break;
-  /* PLA */
-  case 0x68: pla(); break;
-  /* ADC #nn */
-  case 0x69: adc(fetch_op(),2); break;
-  /* ROR A */
-  case 0x6A: ror_a(); break;
-  /* JMP (nnnn) */
-  case 0x6C: jmp_ind(); break;
-  /* ADC nnnn */
-  case 0x6D: adc(load_byte(addr_abs()),4); break;
-  /* ROR nnnn */
-  case 0x6E: ror_mem(addr_abs(),6); break;
-  /* BVS */
-  case 0x70: bvs(); break;
-  /* ADC (nn,Y) */
-  case 0x71: adc(load_byte(addr_indy()),5); break;
-  /* ADC nn,X */
-  case 0x75: adc(load_byte(addr_zerox()),4); break;
-  /* ROR nn,X */
-  case 0x76: ror_mem(addr_zerox(),6); break;
-  /* SEI */
-  case 0x78: sei(); break;
-  /* ADC nnnn,Y */
-  case 0x79: adc(load_byte(addr_absy()),4); break;
-  /* ADC nnnn,X */
-  case 0x7D: adc(load_byte(addr_absx()),4); break;
-  /* ROR nnnn,X */
-  case 0x7E: ror_mem(addr_absx(),7); break;
-  /* STA (nn,X) */
-  case 0x81: sta(addr_indx(),6); break;
-  /* STY nn */
-  case 0x84: sty(addr_zero(),3); break;
-  /* STA nn */
-  case 0x85: sta(addr_zero(),3); break;
-  /* STX nn */
-  case 0x86: stx(addr_zero(),3); break;
-  /* DEY */
-  case 0x88: dey(); break;
-  /* TXA */
-  case 0x8A: txa(); break;
-  /* STY nnnn */
-  case 0x8C: sty(addr_abs(),4); break;
-  /* STA nnnn */
-  case 0x8D: sta(addr_abs(),4); break;
-  /* STX nnnn */
-  case 0x8E: stx(addr_abs(),4); break;
-  /* BCC nn */
-  case 0x90: bcc(); break;
-  /* STA (nn,Y) */
-  case 0x91: sta(addr_indy(),6); break;
-  /* STY nn,X */
-  case 0x94: sty(addr_zerox(),4); break;
-  /* STA nn,X */
-  case 0x95: sta(addr_zerox(),4); break;
-  /* STX nn,Y */
-  case 0x96: stx(addr_zeroy(),4); break;
-  /* TYA */
-  case 0x98: tya(); break;
-  /* STA nnnn,Y */
-  case 0x99: sta(addr_absy(),5); break;
-  /* TXS */
-  case 0x9A: txs(); break;
-  /* STA nnnn,X */
-  case 0x9D: sta(addr_absx(),5); break;
-  /* LDY #nn */
-  case 0xA0: ldy(fetch_op(),2); break; 
-  /* LDA (nn,X) */
-  case 0xA1: lda(load_byte(addr_indx()),6); break;
-  /* LDX #nn */
-  case 0xA2: ldx(fetch_op(),2); break;
-  /* LDY nn */
-  case 0xA4: ldy(load_byte(addr_zero()),3); break;
-  /* LDA nn */
-  case 0xA5: lda(load_byte(addr_zero()),3); break;
-  /* LDX nn */
-  case 0xA6: ldx(load_byte(addr_zero()),3); break;
-  /* TAY */
-  case 0xA8: tay(); break;
-  /* LDA #nn */
-  case 0xA9: lda(fetch_op(),2); break;
-  /* TAX */
-  case 0xAA: tax(); break;
-  /* LDY nnnn */
-  case 0xAC: ldy(load_byte(addr_abs()),4); break;
-  /* LDA nnnn */
-  case 0xAD: lda(load_byte(addr_abs()),4); break;
-  /* LDX nnnn */
-  case 0xAE: ldx(load_byte(addr_abs()),4); break;
-  /* BCS nn */
-  case 0xB0: bcs(); break;
-  /* LDA (nn,Y) */
-  case 0xB1: lda(load_byte(addr_indy()),5); break;
-  /* LDY nn,X */
-  case 0xB4: ldy(load_byte(addr_zerox()),3); break;
-  /* LDA nn,X */
-  case 0xB5: lda(load_byte(addr_zerox()),3); break;
-  /* LDX nn,Y */
-  case 0xB6: ldx(load_byte(addr_zeroy()),3); break;
-  /* CLV */
-  case 0xB8: clv(); break;
-  /* LDA nnnn,Y */
-  case 0xB9: lda(load_byte(addr_absy()),4); break;
-  /* TSX */
-  case 0xBA: tsx(); break;
-  /* LDY nnnn,X */
-  case 0xBC: ldy(load_byte(addr_absx()),4); break;
-  /* LDA nnnn,X */
-  case 0xBD: lda(load_byte(addr_absx()),4); break;
-  /* LDX nnnn,Y */
-  case 0xBE: ldx(load_byte(addr_absy()),4); break;
-  /* CPY #nn */
-  case 0xC0: cpy(fetch_op(),2); break;
-  /* CMP (nn,X) */
-  case 0xC1: cmp(load_byte(addr_indx()),6); break;
-  /* CPY nn */
-  case 0xC4: cpy(load_byte(addr_zero()),3); break;
-  /* CMP nn */
-  case 0xC5: cmp(load_byte(addr_zero()),3); break;
-  /* DEC nn */
-  case 0xC6: dec(addr_zero(),5); break;
-  /* INY */
-  case 0xC8: iny(); break;
-  /* CMP #nn */
-  case 0xC9: cmp(fetch_op(),2); break;
-  /* DEX */
-  case 0xCA: dex(); break;
-  /* CPY nnnn */
-  case 0xCC: cpy(load_byte(addr_abs()),4); break;
-  /* CMP nnnn */
-  case 0xCD: cmp(load_byte(addr_abs()),4); break;
-  /* DEC nnnn */
-  case 0xCE: dec(addr_abs(),6); break;
-  /* BNE nn */
-  case 0xD0: bne(); break;
-  /* CMP (nn,Y) */
-  case 0xD1: cmp(load_byte(addr_indy()),5); break;
-  /* CMP nn,X */
-  case 0xD5: cmp(load_byte(addr_zerox()),4); break;
-  /* DEC nn,X */
-  case 0xD6: dec(addr_zerox(),6); break;
-  /* CLD */
-  case 0xD8: cld(); break;
-  /* CMP nnnn,Y */
-  case 0xD9: cmp(load_byte(addr_absy()),4); break;
-  /* CMP nnnn,X */
-  case 0xDD: cmp(load_byte(addr_absx()),4); break;
-  /* DEC nnnn,X */
-  case 0xDE: dec(addr_absx(),7); break;
-  /* CPX #nn */
-  case 0xE0: cpx(fetch_op(),2); break;
-  /* SBC (nn,X) */
-  case 0xE1: sbc(load_byte(addr_indx()),6); break;
-  /* CPX nn */
-  case 0xE4: cpx(load_byte(addr_zero()),3); break;
-  /* SBC nn */
-  case 0xE5: sbc(load_byte(addr_zero()),3); break;
-  /* INC nn */
-  case 0xE6: inc(addr_zero(),5); break;
-  /* INX */
-  case 0xE8: inx(); break;
-  /* SBC #nn */
-  case 0xE9: sbc(fetch_op(),2); break;
-  /* NOP */
-  case 0xEA: nop(); break;
-  /* CPX nnnn */
-  case 0xEC: cpx(load_byte(addr_abs()),4); break;
-  /* SBC nnnn */
-  case 0xED: sbc(load_byte(addr_abs()),4); break;
-  /* INC nnnn */
-  case 0xEE: inc(addr_abs(),6); break;
-  /* BEQ nn */
-  case 0xF0: beq(); break;
-  /* SBC (nn,Y) */
-  case 0xF1: sbc(load_byte(addr_indy()),5); break;
-  /* SBC nn,X */
-  case 0xF5: sbc(load_byte(addr_zerox()),4); break;
-  /* INC nn,X */
-  case 0xF6: inc(addr_zerox(),6); break;
-  /* SED */
-  case 0xF8: sed(); break;
-  /* SBC nnnn,Y */
-  case 0xF9: sbc(load_byte(addr_absy()),4); break;
-  /* SBC nnnn,X */
-  case 0xFD: sbc(load_byte(addr_absx()),4); break;
-  /* INC nnnn,X */
-  case 0xFE: inc(addr_absx(),7); break;
-  /* Unknown or illegal instruction */
+  /* BRK, JSR, RTI, JMP, RTS, JMP (nnnn) */
+  case 0x00: case 0x20: case 0x40: case 0x4C: case 0x60: case 0x6C:
+  /* conditional branches */
+  case 0x10: case 0x30: case 0x50: case 0x70:
+  case 0x90: case 0xB0: case 0xD0: case 0xF0:
+    return true;
   default:
-    D("Unknown instruction: %X at %04x\n", insn,pc());
-    retval = false;
+    return false;
   }
-  return retval;
 }
 
+/**
+ * @brief fetch and decode the instruction at addr
+ *
+ * Operands are read once here, fetch_op() and fetch_opw() return 
+ * them from the decoded instruction.
+ */
+void Cpu::decode(uint16_t addr, MicroOp *op)
+{
+  op->opcode = load_byte(addr);
+  op->len = kInsnLength[op->opcode];
+  if(op->len == 2)
+    op->operand = load_byte(addr+1);
+  else if(op->len == 3)
+    op->operand = mem_->read_word(addr+1);
+  else
+    op->operand = 0;
+}
+
+/**
+ * @brief get the decoded block of instructions starting at addr
+ *
+ * Straight-line code is decoded once into a direct-mapped cache, a 
+ * block ends at the first instruction that can change the PC, at the 
+ * end of the page or after kMaxBlockOps instructions. Blocks are tagged 
+ * with the generation of their page so writes to it (self-modifying 
+ * code, loaders) and bank switches invalidate them, see Memory.
+ *
+ * Code in I/O pages and instructions straddling two pages are decoded 
+ * every time they are executed.
+ */
+Cpu::Block *Cpu::lookup_block(uint16_t addr)
+{
+  uint8_t page = addr >> 8;
+  uint32_t gen = mem_->code_generation(page);
+  Block *block = &blocks_[(addr ^ (addr >> 6)) & (kBlockCacheSize-1)];
+  if(block->count != 0 && block->pc == addr && block->gen == gen)
+    return block;
+  if(!mem_->io_page(page))
+  {
+    block->pc = addr;
+    block->gen = gen;
+    block->count = 0;
+#if defined(CPU_JIT)
+    block->native = nullptr;
+    block->hits = 0;
+#endif
+    uint16_t next = addr;
+    while(block->count < kMaxBlockOps && (next >> 8) == page)
+    {
+      MicroOp *op = &block->ops[block->count];
+      uint8_t insn = load_byte(next);
+      if((next & 0xff) + kInsnLength[insn] > 0x100)
+        break;
+      decode(next,op);
+      block->count++;
+      next += op->len;
+      if(ends_block(insn))
+        break;
+    }
+    if(block->count != 0)
+    {
+      mem_->watch_code_page(page);
+      return block;
+    }
+  }
+  decode(addr,&scratch_.ops[0]);
+  scratch_.pc = addr;
+  scratch_.gen = gen;
+  scratch_.count = 1;
+#if defined(CPU_JIT)
+  scratch_.native = nullptr;
+  scratch_.hits = Jit::kNever;
+#endif
+  return &scratch_;
+}
+
+#if defined(CPU_JIT)
+
+/**
+ * @brief run a block natively, compiling it once it gets hot
+ * @return false if the block has to be interpreted this time
+ *
+ * Native blocks can't stop half-way for the deadline or a breakpoint,
+ * they only run if the interpreter would have run them to the end.
+ */
+bool Cpu::run_native(Block *block)
+{
+  if(block->native == nullptr)
+  {
+    if(block->hits == Jit::kNever || ++block->hits < Jit::kThreshold)
+      return false;
+    if(!jit_->compile(block))
+    {
+      block->hits = Jit::kNever;
+      return false;
+    }
+  }
+  if((int)(cycles_ + block->cycles - deadline_) >= 0)
+    return false;
+  if(breakpoint_ >= block->pc && breakpoint_ < (int)block->end)
+    return false;
+  jit_->execute(block);
+  return true;
+}
+
+#endif
+
 // helpers ///////////////////////////////////////////////////////////////////
 
 uint8_t Cpu::load_byte(uint16_t addr)
@@ -380,16 +453,17 @@ uint8_t Cpu::pop()
   return load_byte(addr);
 }
  
+/**
+ * @brief operands of the instruction being executed
+ */
 uint8_t Cpu::fetch_op()
 {
-  return load_byte(pc_++);
+  return (uint8_t)op_->operand;
 }
 
 uint16_t Cpu::fetch_opw()
 {
-  uint16_t retval = mem_->read_word(pc_);
-  pc_+=2;
-  return retval;
+  return op_->operand;
 }
 
 uint16_t Cpu::addr_zero()
@@ -487,8 +561,7 @@ void Cpu::txs()
 void Cpu::tsx()
 {
   x(sp());
-  SET_ZF(x());
-  SET_NF(x());
+  SET_NZ(x());
   tick(2);
 }
 
@@ -498,8 +571,7 @@ void Cpu::tsx()
 void Cpu::lda(uint8_t v, uint8_t cycles)
 {
   a(v);
-  SET_ZF(a());
-  SET_NF(a());
+  SET_NZ(a());
   tick(cycles);
 }
 
@@ -509,8 +581,7 @@ void Cpu::lda(uint8_t v, uint8_t cycles)
 void Cpu::ldx(uint8_t v, uint8_t cycles)
 {
   x(v);
-  SET_ZF(x());
-  SET_NF(x());
+  SET_NZ(x());
   tick(cycles);
 }
 
@@ -520,8 +591,7 @@ void Cpu::ldx(uint8_t v, uint8_t cycles)
 void Cpu::ldy(uint8_t v, uint8_t cycles)
 {
   y(v);
-  SET_ZF(y());
-  SET_NF(y());
+  SET_NZ(y());
   tick(cycles);
 }
 
@@ -531,8 +601,7 @@ void Cpu::ldy(uint8_t v, uint8_t cycles)
 void Cpu::txa()
 {
   a(x());
-  SET_ZF(a());
-  SET_NF(a());
+  SET_NZ(a());
   tick(2);
 }
 
@@ -542,8 +611,7 @@ void Cpu::txa()
 void Cpu::tax()
 {
   x(a());
-  SET_ZF(x());
-  SET_NF(x());
+  SET_NZ(x());
   tick(2);
 }
 
@@ -553,8 +621,7 @@ void Cpu::tax()
 void Cpu::tay()
 {
   y(a());
-  SET_ZF(y());
-  SET_NF(y());
+  SET_NZ(y());
   tick(2);
 }
 
@@ -564,8 +631,7 @@ void Cpu::tay()
 void Cpu::tya()
 {
   a(y());
-  SET_ZF(a());
-  SET_NF(a());
+  SET_NZ(a());
   tick(2);
 }
 
@@ -584,8 +650,7 @@ void Cpu::pha()
 void Cpu::pla()
 {
   a(pop());
-  SET_ZF(a());
-  SET_NF(a());
+  SET_NZ(a());
   tick(4);
 }
  
@@ -597,8 +662,7 @@ void Cpu::pla()
 void Cpu::ora(uint8_t v, uint8_t cycles)
 {
   a(a()|v);
-  SET_ZF(a());
-  SET_NF(a());
+  SET_NZ(a());
   tick(cycles);
 }
 
@@ -608,8 +672,7 @@ void Cpu::ora(uint8_t v, uint8_t cycles)
 void Cpu::_and(uint8_t v, uint8_t cycles)
 {
   a(a()&v);
-  SET_ZF(a());
-  SET_NF(a());
+  SET_NZ(a());
   tick(cycles);
 }
 
@@ -620,8 +683,8 @@ void Cpu::bit(uint16_t addr, uint8_t cycles)
 {
   uint8_t t = load_byte(addr);
   of((t&0x40)!=0);
-  SET_NF(t);
-  SET_ZF(t&a());
+  /* N comes from memory, Z from the AND with A */
+  nz_ = (uint8_t)(t&a()) | ((t&0x80) << 1);
   tick(cycles);
 }
  
@@ -632,8 +695,7 @@ uint8_t Cpu::rol(uint8_t v)
 {
   uint16_t t = (v << 1) | (uint8_t)cf();
   cf((t&0x100)!=0);
-  SET_ZF(t);
-  SET_NF(t);
+  SET_NZ(t);
   return (uint8_t)t;
 }
 
@@ -665,8 +727,7 @@ uint8_t Cpu::ror(uint8_t v)
 {
   uint16_t t = (v >> 1) | (uint8_t)(cf() << 7);
   cf((v&0x1)!=0);
-  SET_ZF(t);
-  SET_NF(t);
+  SET_NZ(t);
   return (uint8_t)t;
 }
 
@@ -698,8 +759,7 @@ uint8_t Cpu::lsr(uint8_t v)
 {
   uint8_t t = v >> 1;
   cf((v&0x1)!=0);
-  SET_ZF(t);
-  SET_NF(t);
+  SET_NZ(t);
   return t;
 }
 
@@ -731,8 +791,7 @@ uint8_t Cpu::asl(uint8_t v)
 {
   uint8_t t = (v << 1) & 0xff;
   cf((v&0x80)!=0);
-  SET_ZF(t);
-  SET_NF(t);
+  SET_NZ(t);
   return t;
 }
 
@@ -781,8 +840,7 @@ void Cpu::asl_mem(uint16_t addr, uint8_t cycles)
 void Cpu::eor(uint8_t v, uint8_t cycles)
 {
   a(a()^v);
-  SET_ZF(a());
-  SET_NF(a());
+  SET_NZ(a());
   tick(cycles);
 }
  
@@ -798,8 +856,7 @@ void Cpu::inc(uint16_t addr, uint8_t cycles)
   mem_->write_byte(addr,v);
   v++;
   mem_->write_byte(addr,v);
-  SET_ZF(v);
-  SET_NF(v);
+  SET_NZ(v);
 }
 
 /**
@@ -812,8 +869,7 @@ void Cpu::dec(uint16_t addr, uint8_t cycles)
   mem_->write_byte(addr,v);
   v--;
   mem_->write_byte(addr,v);
-  SET_ZF(v);
-  SET_NF(v);
+  SET_NZ(v);
 }
 
 /**
@@ -822,8 +878,7 @@ void Cpu::dec(uint16_t addr, uint8_t cycles)
 void Cpu::inx()
 {
   x_+=1;
-  SET_ZF(x());
-  SET_NF(x());
+  SET_NZ(x());
   tick(2);
 }
 
@@ -833,8 +888,7 @@ void Cpu::inx()
 void Cpu::iny()
 {
   y_+=1;
-  SET_ZF(y());
-  SET_NF(y());
+  SET_NZ(y());
   tick(2);
 }
 
@@ -844,8 +898,7 @@ void Cpu::iny()
 void Cpu::dex()
 {
   x_-=1;
-  SET_ZF(x());
-  SET_NF(x());
+  SET_NZ(x());
   tick(2);
 }
 
@@ -855,8 +908,7 @@ void Cpu::dex()
 void Cpu::dey()
 {
   y_-=1;
-  SET_ZF(y());
-  SET_NF(y());
+  SET_NZ(y());
   tick(2);
 }
 
@@ -882,8 +934,7 @@ void Cpu::adc(uint8_t v, uint8_t cycles)
   cf(t>0xff);
   t=t&0xff;
   of(!((a()^v)&0x80) && ((a()^t) & 0x80));
-  SET_ZF(t);
-  SET_NF(t);
+  SET_NZ(t);
   a((uint8_t)t);
 }
 
@@ -910,8 +961,7 @@ void Cpu::sbc(uint8_t v, uint8_t cycles)
   cf(t<0x100);
   t=t&0xff;
   of(((a()^t)&0x80) && ((a()^v) & 0x80));
-  SET_ZF(t);
-  SET_NF(t);
+  SET_NZ(t);
   a((uint8_t)t);
 }
  
@@ -982,28 +1032,21 @@ void Cpu::clv()
 
 uint8_t Cpu::flags()
 {
-  uint8_t v=0;
-  v |= cf()  << 0;
-  v |= zf()  << 1;
-  v |= idf() << 2;
-  v |= dmf() << 3;
+  uint8_t v = p_ & (kFlagC|kFlagI|kFlagD|kFlagV);
+  if(zf()) v |= kFlagZ;
   /* brk & php instructions push the bcf flag active */
-  v |= 1 << 4;
+  v |= kFlagB;
   /* unused, always set */
-  v |= 1     << 5;
-  v |= of()  << 6;
-  v |= nf()  << 7;
+  v |= kFlagU;
+  if(nf()) v |= kFlagN;
   return v;
 }
 
 void Cpu::flags(uint8_t v)
 {
-  cf(ISSET_BIT(v,0));
-  zf(ISSET_BIT(v,1));
-  idf(ISSET_BIT(v,2));
-  dmf(ISSET_BIT(v,3));
-  of(ISSET_BIT(v,6));
-  nf(ISSET_BIT(v,7));     
+  /* bcf is not affected */
+  p_ = (p_ & kFlagB) | (v & (kFlagC|kFlagI|kFlagD|kFlagV));
+  nz_ = (ISSET_BIT(v,1) ? 0 : 1) | (ISSET_BIT(v,7) ? 0x100 : 0);
 }
 
 /**
@@ -1089,8 +1132,7 @@ void Cpu::cmp(uint8_t v, uint8_t cycles)
   t = a() - v;
   cf(t<0x100);
   t = t&0xff;
-  SET_ZF(t);
-  SET_NF(t);
+  SET_NZ(t);
   tick(cycles);
 }
 
@@ -1103,8 +1145,7 @@ void Cpu::cpx(uint8_t v, uint8_t cycles)
   t = x() - v;
   cf(t<0x100);
   t = t&0xff;
-  SET_ZF(t);
-  SET_NF(t);
+  SET_NZ(t);
   tick(cycles);
 }
 
@@ -1117,8 +1158,7 @@ void Cpu::cpy(uint8_t v, uint8_t cycles)
   t = y() - v;
   cf(t<0x100);
   t = t&0xff;
-  SET_ZF(t);
-  SET_NF(t);
+  SET_NZ(t);
   tick(cycles);
 }
  
@@ -1245,6 +1285,21 @@ void Cpu::irq()
   }
 }
 
+/**
+ * @brief level of the IRQ line
+ *
+ * While the line is held low an IRQ is taken before every instruction
+ * as long as interrupts are not disabled.
+ */
+void Cpu::irq_line(bool v)
+{
+  if(v != irq_line_)
+  {
+    irq_line_ = v;
+    stop(kStopInterrupt);
+  }
+}
+
 /**
  * @brief Non Maskable Interrupt
  */
@@ -1258,6 +1313,40 @@ void Cpu::nmi()
   tick(7);
 }
 
+// save states ///////////////////////////////////////////////////////////////
+
+/**
+ * @brief copies the chip state out, see C64::save_state()
+ */
+void Cpu::save(State *s)
+{
+  s->pc = pc_;
+  s->sp = sp_;
+  s->a = a_;
+  s->x = x_;
+  s->y = y_;
+  s->p = p_;
+  s->nz = nz_;
+  s->cycles = cycles_;
+  s->irq_line = irq_line_;
+}
+
+/**
+ * @brief restores a state saved with save()
+ */
+void Cpu::load(const State &s)
+{
+  pc_ = s.pc;
+  sp_ = s.sp;
+  a_ = s.a;
+  x_ = s.x;
+  y_ = s.y;
+  p_ = s.p;
+  nz_ = s.nz;
+  cycles_ = s.cycles;
+  irq_line_ = s.irq_line;
+}
+
 // debugging /////////////////////////////////////////////////////////////////
 
 void Cpu::dump_regs()
@@ -21,20 +21,87 @@
 #include <cstdint>
 #include "memory.h"
 
+/**
+ * opcode dispatch engine, can be selected at build time defining 
+ * one of CPU_DISPATCH_THREADED, CPU_DISPATCH_TABLE or 
+ * CPU_DISPATCH_SWITCH, computed gotos are only available on GCC 
+ * and Clang.
+ */
+#if !defined(CPU_DISPATCH_THREADED) && \
+    !defined(CPU_DISPATCH_TABLE) && \
+    !defined(CPU_DISPATCH_SWITCH)
+# if defined(__GNUC__)
+#  define CPU_DISPATCH_THREADED
+# else
+#  define CPU_DISPATCH_TABLE
+# endif
+#endif
+
+class Jit;
+
 /**
  * @brief MOS 6510 microprocessor
  */
 class Cpu
 {
+#if defined(CPU_JIT)
+  friend class Jit;
+#endif
   private:
     /* registers */
     uint16_t pc_;
     uint8_t sp_, a_, x_, y_;
-    /* flags (p/status reg) */
-    bool cf_,zf_,idf_,dmf_,bcf_,of_,nf_;
+    /**
+     * flags (p/status reg), N and Z are evaluated lazily from the 
+     * result of the last instruction that set them (see SET_NZ), bit 8 
+     * of nz_ is used when both are set (BIT, PLP)
+     */
+    uint8_t p_;
+    uint16_t nz_;
     /* memory and clock */
     Memory *mem_;
     unsigned int cycles_;
+    /* run loop state */
+    unsigned int deadline_;
+    int stop_reason_;
+    int breakpoint_;
+    bool stop_on_trap_;
+    bool irq_line_;
+    /* decoded instructions */
+    struct MicroOp
+    {
+      uint8_t opcode;
+      uint8_t len;
+      uint16_t operand;
+    };
+    static const size_t kMaxBlockOps = 16;
+    static const size_t kBlockCacheSize = 1024;
+    typedef void (*NativeBlock)(Cpu *cpu);
+    struct Block
+    {
+      uint16_t pc;
+      uint8_t count;
+      uint32_t gen;
+      MicroOp ops[kMaxBlockOps];
+#if defined(CPU_JIT)
+      /* native code, see Jit */
+      NativeBlock native;
+      uint16_t hits;
+      uint16_t cycles;
+      uint32_t end;
+#endif
+    };
+    static const uint8_t kInsnLength[256];
+    Block *blocks_;
+    Block scratch_;
+    const MicroOp *op_;
+    void decode(uint16_t addr, MicroOp *op);
+    Block *lookup_block(uint16_t addr);
+    inline bool execute();
+#if defined(CPU_JIT)
+    Jit *jit_;
+    bool run_native(Block *block);
+#endif
     /* helpers */
     inline uint8_t load_byte(uint16_t addr);
     inline void push(uint8_t);
@@ -56,6 +123,7 @@ class Cpu
     inline void tick(uint8_t v){cycles_+=v;};
     inline uint8_t flags();
     inline void flags(uint8_t v);
+    inline void flag(uint8_t f, bool v){p_=v?(p_|f):(p_&~f);};
     /* instructions : data handling and memory operations */
     inline void sta(uint16_t addr, uint8_t cycles);
     inline void stx(uint16_t addr, uint8_t cycles);
@@ -123,10 +191,45 @@ class Cpu
     inline void nop();
     inline void brk();
     inline void rti();
+    bool illegal(uint8_t insn);
+#if defined(CPU_DISPATCH_TABLE)
+    /* opcode handlers */
+    typedef bool (Cpu::*OpHandler)();
+    static const OpHandler kDispatchTable[256];
+#define OPCODE(op,len,e) bool op_##op();
+#define ILLEGAL(op)  bool op_##op();
+#include "opcodes.h"
+#undef OPCODE
+#undef ILLEGAL
+#endif
   public:
+    Cpu();
+    ~Cpu();
     /* cpu state */
     void reset();
     bool emulate();
+    /* batched execution */
+    enum kStopReason
+    {
+      kStopBudget,
+      kStopInterrupt,
+      kStopRequested,
+      kStopBreakpoint,
+      kStopTrap,
+      kStopIllegal
+    };
+    struct RunResult
+    {
+      kStopReason reason;
+      unsigned int cycles;
+    };
+    RunResult run(unsigned int budget);
+    void stop(kStopReason r = kStopRequested);
+    void schedule(int v);
+    inline void breakpoint(int v){breakpoint_=v;};
+    inline void stop_on_trap(bool v){stop_on_trap_=v;};
+    static const int kNoEvent = 0x7fffffff;
+    static const int kNoBreakpoint = -1;
     /* memory */
     void memory(Memory *v){mem_ = v;};
     Memory* memory(){return mem_;};
@@ -142,26 +245,47 @@ class Cpu
     inline uint8_t y() {return y_;};
     inline void y(uint8_t v) {y_=v;};
     /* flags */
-    inline bool cf() {return cf_;};
-    inline void cf(bool v) { cf_=v;};
-    inline bool zf() {return zf_;};
-    inline void zf(bool v) {zf_=v;};
-    inline bool idf() {return idf_;};
-    inline void idf(bool v) { idf_=v;};
-    inline bool dmf() {return dmf_;};
-    inline void dmf(bool v) { dmf_=v;};
-    inline bool bcf() {return bcf_;};
-    inline void bcf(bool v) { bcf_=v;};
-    inline bool of() {return of_;};
-    inline void of(bool v) { of_=v;};
-    inline bool nf() {return nf_;};
-    inline void nf(bool v) {nf_=v;};
+    inline bool cf() {return (p_&kFlagC)!=0;};
+    inline void cf(bool v) {flag(kFlagC,v);};
+    inline bool zf() {return (nz_&0xff)==0;};
+    inline void zf(bool v) {nz_=(v?0:1)|(nf()?0x100:0);};
+    inline bool idf() {return (p_&kFlagI)!=0;};
+    inline void idf(bool v) {flag(kFlagI,v);};
+    inline bool dmf() {return (p_&kFlagD)!=0;};
+    inline void dmf(bool v) {flag(kFlagD,v);};
+    inline bool bcf() {return (p_&kFlagB)!=0;};
+    inline void bcf(bool v) {flag(kFlagB,v);};
+    inline bool of() {return (p_&kFlagV)!=0;};
+    inline void of(bool v) {flag(kFlagV,v);};
+    inline bool nf() {return (nz_&0x180)!=0;};
+    inline void nf(bool v) {nz_=(zf()?0:1)|(v?0x100:0);};
+    static const uint8_t kFlagC = 1 << 0;
+    static const uint8_t kFlagZ = 1 << 1;
+    static const uint8_t kFlagI = 1 << 2;
+    static const uint8_t kFlagD = 1 << 3;
+    static const uint8_t kFlagB = 1 << 4;
+    static const uint8_t kFlagU = 1 << 5;
+    static const uint8_t kFlagV = 1 << 6;
+    static const uint8_t kFlagN = 1 << 7;
     /* clock */
     inline unsigned int cycles(){return cycles_;};
     inline void cycles(unsigned int v){cycles_=v;};
     /* interrupts */
     void nmi();
     void irq();
+    void irq_line(bool v);
+    /* save states */
+    struct State
+    {
+      uint16_t pc;
+      uint8_t sp, a, x, y;
+      uint8_t p;
+      uint16_t nz;
+      unsigned int cycles;
+      bool irq_line;
+    };
+    void save(State *s);
+    void load(const State &s);
     /* debug */
     void dump_regs();
     void dump_regs_json();
@@ -169,7 +293,6 @@ class Cpu
 
 /* macro helpers */
 
-#define SET_ZF(val)     (zf(!(uint8_t)(val)))
-#define SET_NF(val)     (nf(((uint8_t)(val)&0x80)!=0))
+#define SET_NZ(val)     (nz_=(uint8_t)(val))
 
 #endif
@@ -0,0 +1,65 @@
+/*
+ * emudore, Commodore 64 emulator
+ * Copyright (c) 2016, Mario Ballano <mballano@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <thread>
+#include "governor.h"
+
+/* pace() binds it to a reference, needs a definition without -O */
+const unsigned int Governor::kMaxLag;
+
+Governor::Governor(double period)
+{
+  period_ = period;
+  speed_ = kRealTime;
+  warp_ = false;
+  paced_speed_ = 0;
+  lagging_ = false;
+}
+
+/**
+ * @brief waits until the next frame is due
+ */
+void Governor::pace()
+{
+  using namespace std::chrono;
+  unsigned int speed = speed_;
+  Clock::time_point now = Clock::now();
+  if(warp_ || speed == 0)
+  {
+    paced_speed_ = 0;
+    lagging_ = false;
+    return;
+  }
+  /* just started or switched speed, count from now */
+  if(speed != paced_speed_)
+  {
+    paced_speed_ = speed;
+    next_ = now;
+  }
+  auto frame = duration_cast<Clock::duration>(
+      duration<double>(period_ * kRealTime / speed));
+  next_ += frame;
+  lagging_ = now > next_;
+  if(now - next_ > frame * kMaxLag)
+    next_ = now;
+  /* coarse sleep, then spin */
+  auto spin = microseconds(kSpinMicroseconds);
+  if(next_ - now > spin)
+    std::this_thread::sleep_for(next_ - now - spin);
+  while(Clock::now() < next_)
+    std::this_thread::yield();
+}
@@ -0,0 +1,66 @@
+/*
+ * emudore, Commodore 64 emulator
+ * Copyright (c) 2016, Mario Ballano <mballano@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMUDORE_GOVERNOR_H
+#define EMUDORE_GOVERNOR_H
+
+#include <atomic>
+#include <chrono>
+
+#include "vic.h"
+
+/**
+ * @brief speed governor
+ *
+ * Paces emulation to a target speed, pace() is called once per frame
+ * and waits until the frame is due. Frames are due at absolute times
+ * so errors do not accumulate, a late frame shortens the next waits
+ * until emulation has caught up (unless it lags more than kMaxLag 
+ * frames behind, then it starts over from now).
+ *
+ * Waits sleep until shortly before the deadline and spin the rest, 
+ * sleeping alone is not accurate enough for stable frame pacing.
+ *
+ * Speed is a percentage of real time, warp() runs unthrottled. Both
+ * can be changed from any thread while running. lagging() tells 
+ * whether the last frame was already late.
+ */
+class Governor
+{
+  private:
+    typedef std::chrono::steady_clock Clock;
+    double period_;
+    std::atomic<unsigned int> speed_;
+    std::atomic<bool> warp_;
+    Clock::time_point next_;
+    unsigned int paced_speed_;
+    bool lagging_;
+  public:
+    Governor(double period = Vic::kRefreshRate);
+    void pace();
+    void speed(unsigned int percent){speed_ = percent;};
+    unsigned int speed(){return speed_;};
+    void warp(bool v){warp_ = v;};
+    bool warp(){return warp_;};
+    bool lagging(){return lagging_;};
+    /* constants */
+    static const unsigned int kRealTime = 100;
+    static const unsigned int kMaxLag = 5;
+    static const unsigned int kSpinMicroseconds = 2000;
+};
+
+#endif
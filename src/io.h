@@ -18,77 +18,101 @@
 #ifndef EMUDORE_IO_H
 #define EMUDORE_IO_H
 
-#include <SDL.h>
 #include <queue>
-#include <chrono>
-#include <thread>
 #include <vector>
 #include <utility>
 #include <unordered_map>
 
 #include "cpu.h"
+#include "sink.h"
 #include "util.h"
 
+class Recorder;
+class Player;
+
 /**
  * @brief IO devices
  *
  * This class implements Input/Output devices connected to the 
  * Commodore 64 such as the screen and keyboard.
  *
- * Current backend is SDL2.
+ * It has no host dependencies, frames are handed over to a Sink 
+ * (SdlSink for the SDL2 frontend) which also provides host input.
+ *
+ * Every keyboard matrix change is reported to the Recorder if any, 
+ * while a Player is attached host and typed input are ignored and the 
+ * recorded changes are replayed instead.
  */
 class IO
 {
+  public:
+    /* keyboard matrix position (row, column) */
+    typedef std::pair<int,int> Key;
   private:
     Cpu *cpu_;
-    SDL_Window *window_;
-    SDL_Renderer *renderer_;
-    SDL_Texture *texture_;
-    SDL_PixelFormat *format_;
-    uint32_t *frame_;
+    Sink *sink_;
+    uint8_t *frame_;
+    uint8_t *own_frame_;
+    void next_frame();
     size_t cols_;
     size_t rows_;
     unsigned int color_palette[16];
     uint8_t keyboard_matrix_[8];
     bool retval_ = true;
-    /* keyboard mappings */
-    std::unordered_map<SDL_Keycode,std::pair<int,int>> keymap_;
-    std::unordered_map<char,std::vector<SDL_Keycode>> charmap_;
+    /* character to key map, for typing */
+    std::unordered_map<char,std::vector<Key>> charmap_;
     enum kKeyEvent
     {
       kPress,
       kRelease,
     };
     /* key events */
-    std::queue<std::pair<kKeyEvent,SDL_Keycode>> key_event_queue_;
+    std::queue<std::pair<kKeyEvent,Key>> key_event_queue_;
     unsigned int next_key_event_at_;
     static const int kWait = 18000;
-    /* vertical refresh sync */
-    std::chrono::high_resolution_clock::time_point prev_frame_was_at_;
-    void vsync();
+    /* input recording and replay */
+    Recorder *recorder_;
+    Player *player_;
   public:
-    IO();
+    IO(Sink *sink = nullptr);
     ~IO();
     bool emulate();
-    void process_events();
+    int next_event();
     void cpu(Cpu *v){cpu_=v;};
     void init_color_palette();
     void init_keyboard();
-    void handle_keydown(SDL_Keycode k);
-    void handle_keyup(SDL_Keycode k);
+    void handle_keydown(Key k);
+    void handle_keyup(Key k);
     void type_character(char c);
     inline uint8_t keyboard_matrix_row(int col){return keyboard_matrix_[col];};
-    void screen_update_pixel(int x, int y, int color);
-    void screen_draw_rect(int x, int y, int n, int color);
-    void screen_draw_border(int y, int color);
-    void screen_refresh();
-};
-
-// inline member functions accesible from other classes /////////////////////
-
-inline void IO::screen_update_pixel(int x, int y, int color)
-{
-  frame_[y * cols_  + x] = color_palette[color & 0xf];
+    void keyboard_matrix_row(int row, uint8_t v);
+    void recorder(Recorder *v){recorder_ = v;};
+    void player(Player *v){player_ = v;};
+    Recorder *recorder(){return recorder_;};
+    Player *player(){return player_;};
+    inline uint8_t *screen_row(int y){return frame_ + y * cols_;};
+    void screen_refresh(bool drawn);
+    void argb(const uint8_t *src, uint32_t *dst, size_t n) const
+      {argb(color_palette,src,dst,n);};
+    static void argb(const unsigned int *palette, const uint8_t *src,
+        uint32_t *dst, size_t n);
+    const unsigned int *palette() const {return color_palette;};
+    bool lagging(){return sink_->lagging();};
+    /* save states, pending typed characters are host input and not saved */
+    struct State
+    {
+      uint8_t keyboard_matrix[8];
+      unsigned int next_key_event_at;
+    };
+    void save(State *s);
+    void load(const State &s);
+    /**
+     * frame being rendered, palette indexes (0-15), see argb(). Holds
+     * the last frame unless the sink provides the buffers.
+     */
+    const uint8_t *frame(){return frame_;};
+    size_t cols(){return cols_;};
+    size_t rows(){return rows_;};
 };
 
 #endif
@@ -0,0 +1,1032 @@
+/*
+ * emudore, Commodore 64 emulator
+ * Copyright (c) 2016, Mario Ballano <mballano@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+
+#include "jit.h"
+#include "util.h"
+
+/* host registers */
+
+enum
+{
+  kNoReg = -1,
+  kRax = 0, kRcx = 1, kRdx = 2, kRbx = 3,
+  kRsp = 4, kRbp = 5, kRsi = 6, kRdi = 7,
+  kR10 = 10, kR11 = 11, kR12 = 12, kR13 = 13, kR14 = 14, kR15 = 15
+};
+
+/**
+ * register allocation, callee-saved registers hold the 6510 state
+ * so helper calls only need to preserve the carry and the page map
+ */
+enum
+{
+  kRegCpu   = kRbx,
+  kRegRam   = kRbp,
+  kRegA     = kR12,
+  kRegX     = kR13,
+  kRegY     = kR14,
+  kRegNZ    = kR15,
+  kRegC     = kR10,
+  kRegPages = kR11
+};
+
+/* condition codes, opcode groups and extensions */
+
+enum { kCondB = 2, kCondAE = 3, kCondE = 4, kCondNE = 5, kCondS = 8 };
+enum { kOpAdd = 0x01, kOpOr = 0x09, kOpAnd = 0x21, kOpSub = 0x29,
+       kOpXor = 0x31, kOpCmp = 0x39, kOpOr8 = 0x08 };
+enum { kExtAdd = 0, kExtOr = 1, kExtAnd = 4, kExtSub = 5, kExtXor = 6,
+       kExtCmp = 7, kExtShl = 4, kExtShr = 5 };
+
+/* supported instructions */
+
+enum Kind
+{
+  kLoad, kStore, kOra, kAnd, kEor, kCmp, kInc, kDec, kIncReg, kDecReg,
+  kTransfer, kClc, kSec, kNop, kAsl, kLsr, kRol, kRor, kBranch, kJmp
+};
+
+enum Mode
+{
+  kImplied, kImm, kZero, kZeroX, kZeroY, kAbs, kAbsX, kAbsY
+};
+
+enum Flag { kFlagZ, kFlagN, kFlagC, kFlagV };
+
+/**
+ * @brief instructions the recompiler understands
+ *
+ * Cycle counts must match opcodes.h, note INC and DEC do not tick
+ * in the interpreter. For branches reg is the flag tested and src
+ * whether the branch is taken when the flag is set.
+ */
+const Jit::Insn Jit::kInsns[] = {
+  /* loads */
+  {0xA9, kLoad, kImm,   kRegA, 0, 2}, {0xA5, kLoad, kZero,  kRegA, 0, 3},
+  {0xB5, kLoad, kZeroX, kRegA, 0, 3}, {0xAD, kLoad, kAbs,   kRegA, 0, 4},
+  {0xBD, kLoad, kAbsX,  kRegA, 0, 4}, {0xB9, kLoad, kAbsY,  kRegA, 0, 4},
+  {0xA2, kLoad, kImm,   kRegX, 0, 2}, {0xA6, kLoad, kZero,  kRegX, 0, 3},
+  {0xB6, kLoad, kZeroY, kRegX, 0, 3}, {0xAE, kLoad, kAbs,   kRegX, 0, 4},
+  {0xBE, kLoad, kAbsY,  kRegX, 0, 4},
+  {0xA0, kLoad, kImm,   kRegY, 0, 2}, {0xA4, kLoad, kZero,  kRegY, 0, 3},
+  {0xB4, kLoad, kZeroX, kRegY, 0, 3}, {0xAC, kLoad, kAbs,   kRegY, 0, 4},
+  {0xBC, kLoad, kAbsX,  kRegY, 0, 4},
+  /* stores */
+  {0x85, kStore, kZero,  kRegA, 0, 3}, {0x95, kStore, kZeroX, kRegA, 0, 4},
+  {0x8D, kStore, kAbs,   kRegA, 0, 4}, {0x9D, kStore, kAbsX,  kRegA, 0, 5},
+  {0x99, kStore, kAbsY,  kRegA, 0, 5},
+  {0x86, kStore, kZero,  kRegX, 0, 3}, {0x96, kStore, kZeroY, kRegX, 0, 4},
+  {0x8E, kStore, kAbs,   kRegX, 0, 4},
+  {0x84, kStore, kZero,  kRegY, 0, 3}, {0x94, kStore, kZeroX, kRegY, 0, 4},
+  {0x8C, kStore, kAbs,   kRegY, 0, 4},
+  /* logic */
+  {0x09, kOra, kImm, kRegA, 0, 2}, {0x05, kOra, kZero, kRegA, 0, 3},
+  {0x15, kOra, kZeroX, kRegA, 0, 4}, {0x0D, kOra, kAbs, kRegA, 0, 4},
+  {0x1D, kOra, kAbsX, kRegA, 0, 4}, {0x19, kOra, kAbsY, kRegA, 0, 4},
+  {0x29, kAnd, kImm, kRegA, 0, 2}, {0x25, kAnd, kZero, kRegA, 0, 3},
+  {0x35, kAnd, kZeroX, kRegA, 0, 4}, {0x2D, kAnd, kAbs, kRegA, 0, 4},
+  {0x3D, kAnd, kAbsX, kRegA, 0, 4}, {0x39, kAnd, kAbsY, kRegA, 0, 4},
+  {0x49, kEor, kImm, kRegA, 0, 2}, {0x45, kEor, kZero, kRegA, 0, 3},
+  {0x55, kEor, kZeroX, kRegA, 0, 4}, {0x4D, kEor, kAbs, kRegA, 0, 4},
+  {0x5D, kEor, kAbsX, kRegA, 0, 4}, {0x59, kEor, kAbsY, kRegA, 0, 4},
+  /* compares */
+  {0xC9, kCmp, kImm, kRegA, 0, 2}, {0xC5, kCmp, kZero, kRegA, 0, 3},
+  {0xD5, kCmp, kZeroX, kRegA, 0, 4}, {0xCD, kCmp, kAbs, kRegA, 0, 4},
+  {0xDD, kCmp, kAbsX, kRegA, 0, 4}, {0xD9, kCmp, kAbsY, kRegA, 0, 4},
+  {0xE0, kCmp, kImm, kRegX, 0, 2}, {0xE4, kCmp, kZero, kRegX, 0, 3},
+  {0xEC, kCmp, kAbs, kRegX, 0, 4},
+  {0xC0, kCmp, kImm, kRegY, 0, 2}, {0xC4, kCmp, kZero, kRegY, 0, 3},
+  {0xCC, kCmp, kAbs, kRegY, 0, 4},
+  /* increments and decrements */
+  {0xE6, kInc, kZero, 0, 0, 0}, {0xF6, kInc, kZeroX, 0, 0, 0},
+  {0xEE, kInc, kAbs,  0, 0, 0}, {0xFE, kInc, kAbsX,  0, 0, 0},
+  {0xC6, kDec, kZero, 0, 0, 0}, {0xD6, kDec, kZeroX, 0, 0, 0},
+  {0xCE, kDec, kAbs,  0, 0, 0}, {0xDE, kDec, kAbsX,  0, 0, 0},
+  {0xE8, kIncReg, kImplied, kRegX, 0, 2}, {0xC8, kIncReg, kImplied, kRegY, 0, 2},
+  {0xCA, kDecReg, kImplied, kRegX, 0, 2}, {0x88, kDecReg, kImplied, kRegY, 0, 2},
+  /* transfers */
+  {0xAA, kTransfer, kImplied, kRegX, kRegA, 2},
+  {0xA8, kTransfer, kImplied, kRegY, kRegA, 2},
+  {0x8A, kTransfer, kImplied, kRegA, kRegX, 2},
+  {0x98, kTransfer, kImplied, kRegA, kRegY, 2},
+  /* flags and misc */
+  {0x18, kClc, kImplied, 0, 0, 2}, {0x38, kSec, kImplied, 0, 0, 2},
+  {0xEA, kNop, kImplied, 0, 0, 2},
+  /* accumulator shifts */
+  {0x0A, kAsl, kImplied, kRegA, 0, 2}, {0x4A, kLsr, kImplied, kRegA, 0, 2},
+  {0x2A, kRol, kImplied, kRegA, 0, 2}, {0x6A, kRor, kImplied, kRegA, 0, 2},
+  /* control flow, always ends a block */
+  {0xD0, kBranch, kImm, kFlagZ, 0, 2}, {0xF0, kBranch, kImm, kFlagZ, 1, 2},
+  {0x10, kBranch, kImm, kFlagN, 0, 2}, {0x30, kBranch, kImm, kFlagN, 1, 2},
+  {0x90, kBranch, kImm, kFlagC, 0, 2}, {0xB0, kBranch, kImm, kFlagC, 1, 2},
+  {0x50, kBranch, kImm, kFlagV, 0, 2}, {0x70, kBranch, kImm, kFlagV, 1, 2},
+  {0x4C, kJmp, kAbs, 0, 0, 3},
+};
+
+Jit::Jit(Cpu *cpu)
+{
+  cpu_ = cpu;
+  used_ = 0;
+  void *p = mmap(nullptr, kCodeSize, PROT_READ|PROT_WRITE|PROT_EXEC,
+      MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED)
+  {
+    D("jit: unable to map code buffer, interpreting only\n");
+    code_ = nullptr;
+  }
+  else
+    code_ = static_cast<uint8_t*>(p);
+}
+
+Jit::~Jit()
+{
+  if(code_ != nullptr)
+    munmap(code_, kCodeSize);
+}
+
+/**
+ * @brief drop all native code
+ */
+void Jit::flush()
+{
+  for(size_t i=0 ; i < Cpu::kBlockCacheSize ; i++)
+    cpu_->blocks_[i].native = nullptr;
+  used_ = 0;
+}
+
+// emitter ///////////////////////////////////////////////////////////////////
+
+Jit::Operand Jit::cpu_field(size_t off)
+{
+  Operand m = {kRegCpu, kNoReg, (int32_t)off};
+  return m;
+}
+
+void Jit::emit(uint8_t b)
+{
+  if(p_ < limit_)
+    *p_ = b;
+  p_++;
+}
+
+void Jit::emit16(uint16_t v)
+{
+  emit(v & 0xff);
+  emit(v >> 8);
+}
+
+void Jit::emit32(uint32_t v)
+{
+  emit16(v & 0xffff);
+  emit16(v >> 16);
+}
+
+void Jit::emit64(uint64_t v)
+{
+  emit32(v & 0xffffffff);
+  emit32(v >> 32);
+}
+
+/**
+ * @brief REX prefix, only emitted when needed
+ *
+ * byte_reg forces it so SPL, BPL, SIL and DIL are used rather
+ * than AH, CH, DH and BH
+ */
+void Jit::rex(bool w, int reg, int index, int base, bool byte_reg)
+{
+  if(index == kNoReg)
+    index = 0;
+  uint8_t r = 0x40 | (w << 3) | ((reg & 8) >> 1) |
+              ((index & 8) >> 2) | ((base & 8) >> 3);
+  if(r != 0x40 || byte_reg)
+    emit(r);
+}
+
+/**
+ * @brief ModRM (and SIB) for [base + index + disp32]
+ */
+void Jit::modrm(int reg, const Operand &m)
+{
+  if(m.index == kNoReg)
+  {
+    emit(0x80 | ((reg & 7) << 3) | (m.base & 7));
+    if((m.base & 7) == kRsp)
+      emit(0x24);
+  }
+  else
+  {
+    emit(0x84 | ((reg & 7) << 3));
+    emit(((m.index & 7) << 3) | (m.base & 7));
+  }
+  emit32(m.disp);
+}
+
+void Jit::mov_ri(int r, uint32_t imm)
+{
+  rex(false, 0, 0, r, false);
+  emit(0xb8 | (r & 7));
+  emit32(imm);
+}
+
+void Jit::mov_ri64(int r, uint64_t imm)
+{
+  rex(true, 0, 0, r, false);
+  emit(0xb8 | (r & 7));
+  emit64(imm);
+}
+
+void Jit::mov_rr(int dst, int src)
+{
+  alu_rr(0x89, dst, src);
+}
+
+void Jit::mov_rr64(int dst, int src)
+{
+  rex(true, src, 0, dst, false);
+  emit(0x89);
+  emit(0xc0 | ((src & 7) << 3) | (dst & 7));
+}
+
+void Jit::alu_rr(uint8_t opc, int dst, int src)
+{
+  rex(false, src, 0, dst, false);
+  emit(opc);
+  emit(0xc0 | ((src & 7) << 3) | (dst & 7));
+}
+
+void Jit::alu_ri(int ext, int dst, uint32_t imm)
+{
+  rex(false, 0, 0, dst, false);
+  emit(0x81);
+  emit(0xc0 | (ext << 3) | (dst & 7));
+  emit32(imm);
+}
+
+void Jit::alu_mi(int ext, const Operand &m, uint32_t imm)
+{
+  rex(false, 0, m.index, m.base, false);
+  emit(0x81);
+  modrm(ext, m);
+  emit32(imm);
+}
+
+void Jit::shift_ri(int ext, int r, uint8_t n)
+{
+  rex(false, 0, 0, r, false);
+  emit(0xc1);
+  emit(0xc0 | (ext << 3) | (r & 7));
+  emit(n);
+}
+
+void Jit::test_rr(int a, int b)
+{
+  alu_rr(0x85, a, b);
+}
+
+void Jit::test_ri(int r, uint32_t imm)
+{
+  rex(false, 0, 0, r, false);
+  emit(0xf7);
+  emit(0xc0 | (r & 7));
+  emit32(imm);
+}
+
+void Jit::movzx_rm(int dst, const Operand &m)
+{
+  rex(false, dst, m.index, m.base, false);
+  emit(0x0f);
+  emit(0xb6);
+  modrm(dst, m);
+}
+
+void Jit::movzx_rr(int dst, int src)
+{
+  rex(false, dst, 0, src, src >= kRsp && src <= kRdi);
+  emit(0x0f);
+  emit(0xb6);
+  emit(0xc0 | ((dst & 7) << 3) | (src & 7));
+}
+
+void Jit::movzx16_rm(int dst, const Operand &m)
+{
+  rex(false, dst, m.index, m.base, false);
+  emit(0x0f);
+  emit(0xb7);
+  modrm(dst, m);
+}
+
+void Jit::load32(int dst, const Operand &m)
+{
+  rex(false, dst, m.index, m.base, false);
+  emit(0x8b);
+  modrm(dst, m);
+}
+
+void Jit::store8(const Operand &m, int src)
+{
+  rex(false, src, m.index, m.base, src >= kRsp && src <= kRdi);
+  emit(0x88);
+  modrm(src, m);
+}
+
+void Jit::store16(const Operand &m, int src)
+{
+  emit(0x66);
+  rex(false, src, m.index, m.base, false);
+  emit(0x89);
+  modrm(src, m);
+}
+
+void Jit::store16i(const Operand &m, uint16_t imm)
+{
+  emit(0x66);
+  rex(false, 0, m.index, m.base, false);
+  emit(0xc7);
+  modrm(0, m);
+  emit16(imm);
+}
+
+void Jit::alu8_mi(int ext, const Operand &m, uint8_t imm)
+{
+  rex(false, 0, m.index, m.base, false);
+  emit(0x80);
+  modrm(ext, m);
+  emit(imm);
+}
+
+void Jit::alu8_mr(uint8_t opc, const Operand &m, int src)
+{
+  rex(false, src, m.index, m.base, src >= kRsp && src <= kRdi);
+  emit(opc);
+  modrm(src, m);
+}
+
+void Jit::test8_mi(const Operand &m, uint8_t imm)
+{
+  rex(false, 0, m.index, m.base, false);
+  emit(0xf6);
+  modrm(0, m);
+  emit(imm);
+}
+
+void Jit::setcc(int cc, int r)
+{
+  rex(false, 0, 0, r, r >= kRsp && r <= kRdi);
+  emit(0x0f);
+  emit(0x90 | cc);
+  emit(0xc0 | (r & 7));
+}
+
+/**
+ * @brief forward jumps, return where the displacement is patched
+ */
+uint8_t *Jit::jcc(int cc)
+{
+  emit(0x0f);
+  emit(0x80 | cc);
+  uint8_t *rel = p_;
+  emit32(0);
+  return rel;
+}
+
+uint8_t *Jit::jmp()
+{
+  emit(0xe9);
+  uint8_t *rel = p_;
+  emit32(0);
+  return rel;
+}
+
+void Jit::jmp(uint8_t *target)
+{
+  patch(jmp(), target);
+}
+
+void Jit::jcc(int cc, uint8_t *target)
+{
+  patch(jcc(cc), target);
+}
+
+void Jit::patch(uint8_t *rel, uint8_t *target)
+{
+  int32_t v = (int32_t)(target - (rel + 4));
+  if(rel + 4 <= limit_)
+    memcpy(rel, &v, sizeof(v));
+}
+
+void Jit::push(int r)
+{
+  rex(false, 0, 0, r, false);
+  emit(0x50 | (r & 7));
+}
+
+void Jit::pop(int r)
+{
+  rex(false, 0, 0, r, false);
+  emit(0x58 | (r & 7));
+}
+
+void Jit::call(const void *fn)
+{
+  mov_ri64(kRax, (uint64_t)fn);
+  emit(0xff);
+  emit(0xd0);
+}
+
+// code generation ///////////////////////////////////////////////////////////
+
+bool Jit::insn(uint8_t opcode, Insn *i)
+{
+  static const size_t kCount = sizeof(kInsns)/sizeof(kInsns[0]);
+  for(size_t n=0 ; n < kCount ; n++)
+  {
+    if(kInsns[n].opcode == opcode)
+    {
+      *i = kInsns[n];
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief true if reads from the page hit RAM in every bank configuration
+ */
+bool Jit::ram_page(uint8_t page)
+{
+  uint16_t addr = page << 8;
+  if(addr >= Memory::kAddrBasicFirstPage &&
+     addr <= Memory::kAddrBasicLastPage)
+    return false;
+  if(addr >= Memory::kAddrKernalFirstPage &&
+     addr <= Memory::kAddrKernalLastPage)
+    return false;
+  return !io_page(page);
+}
+
+/**
+ * @brief true if the page might be mapped to I/O
+ */
+bool Jit::io_page(uint8_t page)
+{
+  uint16_t addr = page << 8;
+  return (addr >= Memory::kAddrVicFirstPage &&
+          addr <= Memory::kAddrVicLastPage) ||
+         addr == Memory::kAddrCIA1Page || addr == Memory::kAddrCIA2Page;
+}
+
+/**
+ * @brief can the operand be read straight from RAM
+ */
+bool Jit::direct_read(const Cpu::MicroOp &op, int mode)
+{
+  switch(mode)
+  {
+  case kZero:
+  case kZeroX:
+  case kZeroY:
+    return true;
+  case kAbs:
+    return ram_page(op.operand >> 8);
+  case kAbsX:
+  case kAbsY:
+    return op.operand <= 0xff00 && ram_page(op.operand >> 8) &&
+           ram_page((op.operand + 0xff) >> 8);
+  }
+  return false;
+}
+
+/**
+ * @brief can the operand be written straight to RAM
+ *
+ * Besides I/O, writes to the processor port change the bank config,
+ * see Memory::write_byte()
+ */
+bool Jit::direct_write(const Cpu::MicroOp &op, int mode)
+{
+  switch(mode)
+  {
+  case kZero:
+  case kAbs:
+    return op.operand != Memory::kAddrMemoryLayout &&
+           !io_page(op.operand >> 8);
+  case kZeroX:
+  case kZeroY:
+    return true;
+  case kAbsX:
+  case kAbsY:
+    return op.operand <= 0xff00 &&
+           op.operand > Memory::kAddrMemoryLayout &&
+           !io_page(op.operand >> 8) && !io_page((op.operand + 0xff) >> 8);
+  }
+  return false;
+}
+
+/**
+ * @brief effective address of indexed modes into EDX
+ */
+void Jit::address(const Cpu::MicroOp &op, int mode)
+{
+  switch(mode)
+  {
+  case kZeroX:
+  case kZeroY:
+    mov_rr(kRdx, mode == kZeroX ? kRegX : kRegY);
+    alu_ri(kExtAdd, kRdx, op.operand);
+    alu_ri(kExtAnd, kRdx, 0xff);
+    break;
+  case kAbsX:
+  case kAbsY:
+    mov_rr(kRdx, mode == kAbsX ? kRegX : kRegY);
+    alu_ri(kExtAdd, kRdx, op.operand);
+    alu_ri(kExtAnd, kRdx, 0xffff);
+    break;
+  }
+}
+
+static bool indexed(int mode)
+{
+  return mode == kZeroX || mode == kZeroY || mode == kAbsX || mode == kAbsY;
+}
+
+/**
+ * @brief bring Cpu::cycles_ up to date before calling into Memory
+ *
+ * Chips read the CPU clock when their registers are accessed, elapsed
+ * are the cycles of the instructions completed so far in this pass.
+ */
+void Jit::sync_cycles(unsigned int elapsed, unsigned int *synced)
+{
+  if(elapsed != *synced)
+  {
+    alu_mi(kExtAdd, cpu_field(offsetof(Cpu, cycles_)), elapsed - *synced);
+    *synced = elapsed;
+  }
+}
+
+/**
+ * @brief load the operand into EAX (address into EDX if indexed)
+ */
+void Jit::read(const Cpu::MicroOp &op, int mode,
+    unsigned int elapsed, unsigned int *synced)
+{
+  Operand ram = {kRegRam, kNoReg, op.operand};
+  if(mode == kImm)
+  {
+    mov_ri(kRax, op.operand & 0xff);
+    return;
+  }
+  address(op, mode);
+  if(indexed(mode))
+  {
+    ram.index = kRdx;
+    ram.disp = 0;
+  }
+  if(direct_read(op, mode))
+  {
+    movzx_rm(kRax, ram);
+    return;
+  }
+  sync_cycles(elapsed, synced);
+  push(kRegC);
+  push(kRegPages);
+  mov_rr64(kRdi, kRegCpu);
+  if(indexed(mode))
+    mov_rr(kRsi, kRdx);
+  else
+    mov_ri(kRsi, op.operand);
+  call((const void *)&Jit::read_helper);
+  pop(kRegPages);
+  pop(kRegC);
+  /* the helper clobbers EDX */
+  address(op, mode);
+}
+
+/**
+ * @brief store ECX (EAX holds the old value for read-modify-write)
+ * @return false if the store always leaves the block
+ *
+ * Stores to pages holding decoded code or that might be I/O go through
+ * Memory, the block is left right after them.
+ */
+bool Jit::write(const Cpu::MicroOp &op, int mode, bool rmw,
+    unsigned int elapsed, unsigned int synced, unsigned int cycles,
+    uint16_t next, std::vector<uint8_t*> &exits)
+{
+  uint8_t *cont = nullptr;
+  bool direct = direct_write(op, mode);
+  if(direct)
+  {
+    Operand ram = {kRegRam, kNoReg, op.operand};
+    Operand pages = {kRegPages, kNoReg, op.operand >> 8};
+    uint8_t *port = nullptr;
+    if(indexed(mode))
+    {
+      mov_rr(kRsi, kRdx);
+      shift_ri(kExtShr, kRsi, 8);
+      pages.index = kRsi;
+      pages.disp = 0;
+      ram.index = kRdx;
+      ram.disp = 0;
+    }
+    alu8_mi(kExtCmp, pages, 0);
+    uint8_t *watched = jcc(kCondNE);
+    if(mode == kZeroX || mode == kZeroY)
+    {
+      alu_ri(kExtCmp, kRdx, Memory::kAddrMemoryLayout);
+      port = jcc(kCondE);
+    }
+    store8(ram, kRcx);
+    cont = jmp();
+    patch(watched, p_);
+    if(port != nullptr)
+      patch(port, p_);
+  }
+  sync_cycles(elapsed, &synced);
+  push(kRegC);
+  push(kRegPages);
+  mov_rr64(kRdi, kRegCpu);
+  if(indexed(mode))
+    mov_rr(kRsi, kRdx);
+  else
+    mov_ri(kRsi, op.operand);
+  if(rmw)
+  {
+    mov_rr(kRdx, kRax);
+    call((const void *)&Jit::rmw_helper);
+  }
+  else
+  {
+    mov_rr(kRdx, kRcx);
+    call((const void *)&Jit::write_helper);
+  }
+  pop(kRegPages);
+  pop(kRegC);
+  leave(next, elapsed + cycles, synced, exits);
+  if(cont != nullptr)
+    patch(cont, p_);
+  return direct;
+}
+
+/**
+ * @brief leave the block continuing at pc
+ */
+void Jit::leave(uint16_t pc, unsigned int elapsed, unsigned int synced,
+    std::vector<uint8_t*> &exits)
+{
+  sync_cycles(elapsed, &synced);
+  store16i(cpu_field(offsetof(Cpu, pc_)), pc);
+  exits.push_back(jmp());
+}
+
+/**
+ * @brief compile a decoded block
+ * @return false if the block can't be compiled
+ *
+ * Native code runs the whole block, it is only entered if all of it
+ * fits before the CPU deadline (see Cpu::run_native()). A block that
+ * branches back to its own start loops natively for as long as the
+ * next pass still fits.
+ */
+bool Jit::compile(Cpu::Block *block)
+{
+  Insn insns[Cpu::kMaxBlockOps];
+  unsigned int total = 0;
+  uint16_t addr = block->pc;
+  if(code_ == nullptr)
+    return false;
+  for(size_t n=0 ; n < block->count ; n++)
+  {
+    const Cpu::MicroOp &op = block->ops[n];
+    Insn &i = insns[n];
+    if(!insn(op.opcode, &i))
+      return false;
+    uint16_t next = addr + op.len;
+    /* jumps to themselves are traps, see Cpu::stop_on_trap() */
+    if((i.kind == kBranch && (uint16_t)(next + (int8_t)op.operand) == addr) ||
+       (i.kind == kJmp && op.operand == addr))
+      return false;
+#if defined(CPU_JIT_LOCKSTEP)
+    /* chip accesses can't be replayed, keep to RAM */
+    if(i.mode != kImplied && i.mode != kImm && i.kind != kJmp &&
+       (!direct_read(op, i.mode) || !direct_write(op, i.mode)))
+      return false;
+#endif
+    total += i.cycles;
+    addr = next;
+  }
+  if(used_ + kMaxBlockCode > kCodeSize)
+    flush();
+  p_ = code_ + used_;
+  limit_ = code_ + used_ + kMaxBlockCode;
+  uint8_t *start = p_;
+  /* prologue, 6 pushes + 8 bytes keep the stack 16 byte aligned */
+  push(kRbx);
+  push(kRbp);
+  push(kR12);
+  push(kR13);
+  push(kR14);
+  push(kR15);
+  emit(0x48); emit(0x83); emit(0xec); emit(0x08);
+  mov_rr64(kRegCpu, kRdi);
+  mov_ri64(kRegRam, (uint64_t)cpu_->mem_->mem_ram_);
+  mov_ri64(kRegPages, (uint64_t)cpu_->mem_->code_pages_);
+  movzx_rm(kRegA, cpu_field(offsetof(Cpu, a_)));
+  movzx_rm(kRegX, cpu_field(offsetof(Cpu, x_)));
+  movzx_rm(kRegY, cpu_field(offsetof(Cpu, y_)));
+  movzx_rm(kRegC, cpu_field(offsetof(Cpu, p_)));
+  alu_ri(kExtAnd, kRegC, Cpu::kFlagC);
+  movzx16_rm(kRegNZ, cpu_field(offsetof(Cpu, nz_)));
+  uint8_t *loop = p_;
+  /* body */
+  std::vector<uint8_t*> exits;
+  unsigned int elapsed = 0;
+  unsigned int synced = 0;
+  bool open = true;
+  addr = block->pc;
+  for(size_t n=0 ; n < block->count && open ; n++)
+  {
+    const Cpu::MicroOp &op = block->ops[n];
+    const Insn &i = insns[n];
+    uint16_t next = addr + op.len;
+    uint16_t target = 0;
+    uint8_t *taken;
+    switch(i.kind)
+    {
+    case kLoad:
+      read(op, i.mode, elapsed, &synced);
+      mov_rr(i.reg, kRax);
+      mov_rr(kRegNZ, kRax);
+      break;
+    case kStore:
+      address(op, i.mode);
+      mov_rr(kRcx, i.reg);
+      open = write(op, i.mode, false, elapsed, synced, i.cycles, next, exits);
+      break;
+    case kOra:
+    case kAnd:
+    case kEor:
+      read(op, i.mode, elapsed, &synced);
+      alu_rr(i.kind == kOra ? kOpOr : i.kind == kAnd ? kOpAnd : kOpXor,
+          kRegA, kRax);
+      mov_rr(kRegNZ, kRegA);
+      break;
+    case kCmp:
+      read(op, i.mode, elapsed, &synced);
+      mov_rr(kRcx, i.reg);
+      alu_rr(kOpSub, kRcx, kRax);
+      setcc(kCondAE, kRdx);
+      movzx_rr(kRegC, kRdx);
+      movzx_rr(kRegNZ, kRcx);
+      break;
+    case kInc:
+    case kDec:
+      read(op, i.mode, elapsed, &synced);
+      mov_rr(kRcx, kRax);
+      alu_ri(i.kind == kInc ? kExtAdd : kExtSub, kRcx, 1);
+      alu_ri(kExtAnd, kRcx, 0xff);
+      mov_rr(kRegNZ, kRcx);
+      open = write(op, i.mode, true, elapsed, synced, i.cycles, next, exits);
+      break;
+    case kIncReg:
+    case kDecReg:
+      alu_ri(i.kind == kIncReg ? kExtAdd : kExtSub, i.reg, 1);
+      alu_ri(kExtAnd, i.reg, 0xff);
+      mov_rr(kRegNZ, i.reg);
+      break;
+    case kTransfer:
+      mov_rr(i.reg, i.src);
+      mov_rr(kRegNZ, i.reg);
+      break;
+    case kClc:
+    case kSec:
+      mov_ri(kRegC, i.kind == kSec);
+      break;
+    case kNop:
+      break;
+    case kAsl:
+      mov_rr(kRegC, kRegA);
+      shift_ri(kExtShr, kRegC, 7);
+      shift_ri(kExtShl, kRegA, 1);
+      alu_ri(kExtAnd, kRegA, 0xff);
+      mov_rr(kRegNZ, kRegA);
+      break;
+    case kLsr:
+      mov_rr(kRegC, kRegA);
+      alu_ri(kExtAnd, kRegC, 1);
+      shift_ri(kExtShr, kRegA, 1);
+      mov_rr(kRegNZ, kRegA);
+      break;
+    case kRol:
+      shift_ri(kExtShl, kRegA, 1);
+      alu_rr(kOpOr, kRegA, kRegC);
+      mov_rr(kRegC, kRegA);
+      shift_ri(kExtShr, kRegC, 8);
+      alu_ri(kExtAnd, kRegA, 0xff);
+      mov_rr(kRegNZ, kRegA);
+      break;
+    case kRor:
+      mov_rr(kRax, kRegC);
+      shift_ri(kExtShl, kRax, 7);
+      mov_rr(kRegC, kRegA);
+      alu_ri(kExtAnd, kRegC, 1);
+      shift_ri(kExtShr, kRegA, 1);
+      alu_rr(kOpOr, kRegA, kRax);
+      mov_rr(kRegNZ, kRegA);
+      break;
+    case kBranch:
+      switch(i.reg)
+      {
+      case kFlagZ: test_ri(kRegNZ, 0xff); break;
+      case kFlagN: test_ri(kRegNZ, 0x180); break;
+      case kFlagC: test_rr(kRegC, kRegC); break;
+      case kFlagV: test8_mi(cpu_field(offsetof(Cpu, p_)), Cpu::kFlagV); break;
+      }
+      {
+        /* condition code for "flag is set" */
+        int cc = (i.reg == kFlagZ) ? kCondE : kCondNE;
+        taken = jcc(i.src ? cc : cc ^ 1);
+      }
+      leave(next, elapsed + i.cycles, synced, exits);
+      patch(taken, p_);
+      target = next + (int8_t)op.operand;
+      open = false;
+      break;
+    case kJmp:
+      target = op.operand;
+      open = false;
+      break;
+    }
+    elapsed += i.cycles;
+    addr = next;
+    if(i.kind == kBranch || i.kind == kJmp)
+    {
+      if(target == block->pc && block->count > 1)
+      {
+        /* loop while the next pass fits before the deadline */
+        sync_cycles(elapsed, &synced);
+        load32(kRax, cpu_field(offsetof(Cpu, cycles_)));
+        alu_ri(kExtAdd, kRax, total);
+        load32(kRcx, cpu_field(offsetof(Cpu, deadline_)));
+        alu_rr(kOpSub, kRax, kRcx);
+        jcc(kCondS, loop);
+      }
+      leave(target, elapsed, synced, exits);
+    }
+  }
+  if(open)
+    leave(addr, elapsed, synced, exits);
+  /* epilogue, write back the state */
+  for(size_t n=0 ; n < exits.size() ; n++)
+    patch(exits[n], p_);
+  store8(cpu_field(offsetof(Cpu, a_)), kRegA);
+  store8(cpu_field(offsetof(Cpu, x_)), kRegX);
+  store8(cpu_field(offsetof(Cpu, y_)), kRegY);
+  alu8_mi(kExtAnd, cpu_field(offsetof(Cpu, p_)), (uint8_t)~Cpu::kFlagC);
+  alu8_mr(kOpOr8, cpu_field(offsetof(Cpu, p_)), kRegC);
+  store16(cpu_field(offsetof(Cpu, nz_)), kRegNZ);
+  emit(0x48); emit(0x83); emit(0xc4); emit(0x08);
+  pop(kR15);
+  pop(kR14);
+  pop(kR13);
+  pop(kR12);
+  pop(kRbp);
+  pop(kRbx);
+  emit(0xc3);
+  if(p_ > limit_)
+    return false;
+  used_ = p_ - code_;
+  block->native = reinterpret_cast<Cpu::NativeBlock>(start);
+  block->cycles = total;
+  block->end = addr;
+  return true;
+}
+
+// execution /////////////////////////////////////////////////////////////////
+
+uint32_t Jit::read_helper(Cpu *cpu, uint32_t addr)
+{
+  return cpu->mem_->read_byte(addr);
+}
+
+void Jit::write_helper(Cpu *cpu, uint32_t addr, uint32_t v)
+{
+  cpu->mem_->write_byte(addr, v);
+}
+
+void Jit::rmw_helper(Cpu *cpu, uint32_t addr, uint32_t v, uint32_t nv)
+{
+  /* see Cpu::asl_mem() */
+  cpu->mem_->write_byte(addr, v);
+  cpu->mem_->write_byte(addr, nv);
+}
+
+#if defined(CPU_JIT_LOCKSTEP)
+
+/**
+ * @brief CPU state compared in lockstep mode
+ */
+struct Regs
+{
+  uint16_t pc;
+  uint8_t a, x, y, sp;
+  bool cf, zf, idf, dmf, bcf, of, nf;
+  unsigned int cycles;
+};
+
+static Regs regs(Cpu *cpu)
+{
+  Regs r;
+  r.pc = cpu->pc(); r.a = cpu->a(); r.x = cpu->x(); r.y = cpu->y();
+  r.sp = cpu->sp(); r.cf = cpu->cf(); r.zf = cpu->zf(); r.idf = cpu->idf();
+  r.dmf = cpu->dmf(); r.bcf = cpu->bcf(); r.of = cpu->of(); r.nf = cpu->nf();
+  r.cycles = cpu->cycles();
+  return r;
+}
+
+static void regs(Cpu *cpu, const Regs &r)
+{
+  cpu->pc(r.pc); cpu->a(r.a); cpu->x(r.x); cpu->y(r.y); cpu->sp(r.sp);
+  cpu->cf(r.cf); cpu->zf(r.zf); cpu->idf(r.idf); cpu->dmf(r.dmf);
+  cpu->bcf(r.bcf); cpu->of(r.of); cpu->nf(r.nf); cpu->cycles(r.cycles);
+}
+
+static bool same(const Regs &a, const Regs &b)
+{
+  return a.pc == b.pc && a.a == b.a && a.x == b.x && a.y == b.y &&
+         a.sp == b.sp && a.cf == b.cf && a.zf == b.zf && a.idf == b.idf &&
+         a.dmf == b.dmf && a.bcf == b.bcf && a.of == b.of &&
+         a.nf == b.nf && a.cycles == b.cycles;
+}
+
+static void dump(const char *s, const Regs &r)
+{
+  D("%s: pc=%04x a=%02x x=%02x y=%02x sp=%02x c=%d z=%d v=%d n=%d "
+    "cycles=%u\n", s, r.pc, r.a, r.x, r.y, r.sp, r.cf, r.zf, r.of, r.nf,
+    r.cycles);
+}
+
+#endif
+
+/**
+ * @brief run a compiled block
+ *
+ * With CPU_JIT_LOCKSTEP defined every pass is replayed on the
+ * interpreter, registers and RAM must match or emudore aborts.
+ */
+void Jit::execute(Cpu::Block *block)
+{
+#if defined(CPU_JIT_LOCKSTEP)
+  uint8_t *ram = cpu_->mem_->mem_ram_;
+  std::vector<uint8_t> before_ram(ram, ram + Memory::kMemSize);
+  Regs before = regs(cpu_);
+  block->native(cpu_);
+  std::vector<uint8_t> native_ram(ram, ram + Memory::kMemSize);
+  Regs native = regs(cpu_);
+  /* replay */
+  std::copy(before_ram.begin(), before_ram.end(), ram);
+  regs(cpu_, before);
+  while((int)(cpu_->cycles() - native.cycles) < 0)
+  {
+    if(!cpu_->emulate())
+      break;
+  }
+  Regs interpreted = regs(cpu_);
+  if(!same(native, interpreted) ||
+     memcmp(&native_ram[0], ram, Memory::kMemSize) != 0)
+  {
+    D("jit: block at %04x differs from the interpreter\n", block->pc);
+    dump("before", before);
+    dump("native", native);
+    dump("interpreter", interpreted);
+    for(size_t i=0 ; i < Memory::kMemSize ; i++)
+    {
+      if(native_ram[i] != ram[i])
+        D("ram %04zx: native=%02x interpreter=%02x\n", i, native_ram[i], ram[i]);
+    }
+    std::abort();
+  }
+#else
+  block->native(cpu_);
+#endif
+}
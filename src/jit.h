@@ -0,0 +1,136 @@
+/*
+ * emudore, Commodore 64 emulator
+ * Copyright (c) 2016, Mario Ballano <mballano@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMUDORE_JIT_H
+#define EMUDORE_JIT_H
+
+#include <cstdint>
+#include <vector>
+#include "cpu.h"
+
+/**
+ * @brief x86-64 dynamic recompiler
+ *
+ * Compiles hot decoded blocks (see Cpu::lookup_block()) into native
+ * code, only a subset of the instruction set is supported: loads,
+ * stores, logic, compares, increments, transfers and shifts of the
+ * accumulator, blocks containing anything else are left to the
+ * interpreter. While a block runs A, X, Y, the carry and the last
+ * result (Cpu::nz_, N and Z are derived from it) live in host 
+ * registers.
+ *
+ * Memory that is RAM in every bank configuration is accessed directly,
+ * everything else (ROM, I/O) goes through Memory. Writes to pages
+ * holding decoded code also go through Memory and leave the block, so
+ * self-modifying code falls back to the interpreter.
+ *
+ * Linux x86-64 (System V ABI) only, see the JIT option in CMakeLists.txt
+ */
+class Jit
+{
+  private:
+    Cpu *cpu_;
+    uint8_t *code_;
+    size_t used_;
+    /* emitter */
+    uint8_t *p_;
+    uint8_t *limit_;
+    struct Operand
+    {
+      int base;
+      int index;
+      int32_t disp;
+    };
+    inline Operand cpu_field(size_t off);
+    inline void emit(uint8_t b);
+    inline void emit16(uint16_t v);
+    inline void emit32(uint32_t v);
+    void emit64(uint64_t v);
+    void rex(bool w, int reg, int index, int base, bool byte_reg);
+    void modrm(int reg, const Operand &m);
+    void mov_ri(int r, uint32_t imm);
+    void mov_ri64(int r, uint64_t imm);
+    void mov_rr(int dst, int src);
+    void mov_rr64(int dst, int src);
+    void alu_rr(uint8_t opc, int dst, int src);
+    void alu_ri(int ext, int dst, uint32_t imm);
+    void alu_mi(int ext, const Operand &m, uint32_t imm);
+    void shift_ri(int ext, int r, uint8_t n);
+    void test_rr(int a, int b);
+    void test_ri(int r, uint32_t imm);
+    void movzx_rm(int dst, const Operand &m);
+    void movzx16_rm(int dst, const Operand &m);
+    void movzx_rr(int dst, int src);
+    void load32(int dst, const Operand &m);
+    void store8(const Operand &m, int src);
+    void store16(const Operand &m, int src);
+    void store16i(const Operand &m, uint16_t imm);
+    void alu8_mi(int ext, const Operand &m, uint8_t imm);
+    void alu8_mr(uint8_t opc, const Operand &m, int src);
+    void test8_mi(const Operand &m, uint8_t imm);
+    void setcc(int cc, int r);
+    uint8_t *jcc(int cc);
+    uint8_t *jmp();
+    void jmp(uint8_t *target);
+    void jcc(int cc, uint8_t *target);
+    void patch(uint8_t *rel, uint8_t *target);
+    void push(int r);
+    void pop(int r);
+    void call(const void *fn);
+    /* code generation */
+    struct Insn
+    {
+      uint8_t opcode;
+      uint8_t kind;
+      uint8_t mode;
+      int8_t reg;
+      int8_t src;
+      uint8_t cycles;
+    };
+    static const Insn kInsns[];
+    static bool insn(uint8_t opcode, Insn *i);
+    static bool ram_page(uint8_t page);
+    static bool io_page(uint8_t page);
+    bool direct_read(const Cpu::MicroOp &op, int mode);
+    bool direct_write(const Cpu::MicroOp &op, int mode);
+    void address(const Cpu::MicroOp &op, int mode);
+    void sync_cycles(unsigned int elapsed, unsigned int *synced);
+    void read(const Cpu::MicroOp &op, int mode,
+        unsigned int elapsed, unsigned int *synced);
+    bool write(const Cpu::MicroOp &op, int mode, bool rmw,
+        unsigned int elapsed, unsigned int synced, unsigned int cycles,
+        uint16_t next, std::vector<uint8_t*> &exits);
+    void leave(uint16_t pc, unsigned int elapsed, unsigned int synced,
+        std::vector<uint8_t*> &exits);
+    /* helpers called from native code */
+    static uint32_t read_helper(Cpu *cpu, uint32_t addr);
+    static void write_helper(Cpu *cpu, uint32_t addr, uint32_t v);
+    static void rmw_helper(Cpu *cpu, uint32_t addr, uint32_t v, uint32_t nv);
+  public:
+    Jit(Cpu *cpu);
+    ~Jit();
+    bool compile(Cpu::Block *block);
+    void flush();
+    void execute(Cpu::Block *block);
+    /* constants */
+    static const size_t kCodeSize = 1 << 20;
+    static const size_t kMaxBlockCode = 4096;
+    static const uint16_t kThreshold = 32;
+    static const uint16_t kNever = 0xffff;
+};
+
+#endif
@@ -15,7 +15,9 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include "loader.h"
+#include "bootcache.h"
 
 Loader::Loader(C64 *c64)
 {
@@ -24,10 +26,38 @@ Loader::Loader(C64 *c64)
   cpu_ = c64_->cpu();
   mem_ = c64_->memory();
   booted_up_ = false;
+  warm_boot_ = false;
   format_ = kNone;
+  /* have the CPU stop once BASIC is ready */
+  cpu_->breakpoint(kBasicReady);
 }
+
 // common ///////////////////////////////////////////////////////////////////
 
+/**
+ * @brief loads a program picking the format from its extension
+ *
+ * Returns false if the format is not supported
+ */
+bool Loader::load(const std::string &f)
+{
+  size_t ext_i = f.find_last_of(".");
+  if(ext_i != std::string::npos)
+  {
+    std::string ext(f.substr(ext_i+1));
+    std::transform(ext.begin(),ext.end(),ext.begin(),::tolower);
+    if(ext == "bas"){
+      bas(f);
+      return true;
+    }
+    else if(ext == "prg"){
+      prg(f);
+      return true;
+    }
+  }
+  return false;
+}
+
 uint16_t Loader::read_short_le()
 {
   char b;
@@ -39,6 +69,24 @@ uint16_t Loader::read_short_le()
   return v;
 }
 
+/**
+ * @brief skips the KERNAL cold start using a post-boot snapshot
+ *
+ * The first machine booting a given ROM set goes through the cold 
+ * start and leaves a snapshot in the BootCache once BASIC is ready, 
+ * later ones restore it and get the program injected right away.
+ */
+void Loader::warm_boot()
+{
+  warm_boot_ = true;
+  if(!booted_up_ && BootCache::restore(c64_))
+  {
+    booted_up_ = true;
+    cpu_->breakpoint(Cpu::kNoBreakpoint);
+    emulate();
+  }
+}
+
 // BASIC listings ///////////////////////////////////////////////////////////
 
 void Loader::bas(const std::string &f)
@@ -99,28 +147,36 @@ void Loader::load_prg()
  
 // emulate //////////////////////////////////////////////////////////////////
 
+/**
+ * @brief loads the program once BASIC is ready
+ *
+ * Returns false once there is nothing left to do, a program given 
+ * later (e.g. still downloading) is loaded by the next call.
+ */
 bool Loader::emulate()
 {
-  if(booted_up_)
+  if(!booted_up_)
   {
-    switch(format_)
-    {
-    case kBasic: 
-      load_basic();
-      break;
-    case kPRG:
-      load_prg();
-      break;
-    default: 
-      break;
-    }
-    return false;
+    /* wait until BASIC is ready */
+    if(cpu_->pc() != kBasicReady)
+      return true;
+    booted_up_ = true;
+    cpu_->breakpoint(Cpu::kNoBreakpoint);
+    if(warm_boot_)
+      BootCache::store(c64_);
   }
-  else
+  switch(format_)
   {
-    /* at this point BASIC is ready */
-    if(cpu_->pc() == 0xa65c)
-      booted_up_ = true;
+  case kBasic: 
+    load_basic();
+    break;
+  case kPRG:
+    load_prg();
+    break;
+  default: 
+    break;
   }
-  return true;
+  /* only once */
+  format_ = kNone;
+  return false;
 }
@@ -23,11 +23,15 @@
 
 /**
  * @brief Program loader
+ *
+ * Waits for BASIC to be ready then loads the program into its own
+ * C64, call emulate() whenever the CPU stops (see C64::callback()).
  */
 class Loader
 {
   private:
     bool booted_up_;
+    bool warm_boot_;
     C64 *c64_;
     IO *io_;
     Cpu *cpu_;
@@ -45,6 +49,8 @@ class Loader
     uint16_t read_short_le();
   public:
     Loader(C64 *c64);
+    bool load(const std::string &f);
+    void warm_boot();
     void bas(const std::string &f);
     void prg(const std::string &f);
     bool emulate();
@@ -54,6 +60,7 @@ class Loader
     static const uint16_t kBasicVarTab   = 0x002d; 
     static const uint16_t kBasicAryTab   = 0x002f;
     static const uint16_t kBasicStrEnd   = 0x0031;
+    static const uint16_t kBasicReady    = 0xa65c;
 };
 
 #endif
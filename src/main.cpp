@@ -15,87 +15,148 @@
  * limitations under the License.
  */
  
+#include <cstdio>
 #include <iostream>
 #include <string>
-#include <algorithm>
 
 #include "c64.h"
 #include "loader.h"
+#include "recorder.h"
+#include "player.h"
+#include "rewind.h"
+#include "sdlsink.h"
 #ifdef EMSCRIPTEN
 #include <emscripten.h>
-#endif
-
-C64 *c64;
-Loader *loader;
-bool wget_download_finished = false;
 
-bool loader_cb()
+void emscripten_loop(void *c64)
 {
-  if(!loader->emulate())
-    c64->callback(nullptr);
-  return true;
+  static_cast<C64*>(c64)->emscripten_loop();
 }
 
-bool emscripten_loader_cb()
+void wget_cb(unsigned int handle, void *loader, const char *f)
 {
-  if (!loader->emulate() && wget_download_finished)
-    c64->callback(nullptr);
-  return true;
+  static_cast<Loader*>(loader)->load(f);
 }
+#endif
 
-void load_file(const char *file)
+/**
+ * @brief SDL2 frontend
+ *
+ *  emudore [-W | -S percent] [-k n/m] [-a] [-R seconds]
+ *          [-r recording | -p recording [-s frame]] [program]
+ *
+ * -W runs unthrottled (warp), -S at the given percentage of real 
+ * time, see SdlSink for switching at runtime. -k skips drawing n out
+ * of every m frames, -a skips frames while the host lags behind. 
+ * -R keeps the given number of seconds for F9 to rewind through (see
+ * Rewind). -r records the keyboard input (see Recorder) once the 
+ * program is loaded, -p replays a recording, fast-forwarding to frame
+ * with -s.
+ */
+int main(int argc, char **argv)
 {
-  std::string f(file);
-  size_t ext_i = f.find_last_of(".");
-  if(ext_i != std::string::npos)
+  std::string program, record, replay;
+  unsigned int seek = 0;
+  unsigned int speed = Governor::kRealTime;
+  bool warp = false;
+  unsigned int skip = 0, skip_period = 0;
+  bool adaptive_skip = false;
+  unsigned int rewind_seconds = 0;
+  for(int i=1 ; i < argc ; i++)
   {
-    std::string ext(f.substr(ext_i+1));
-    std::transform(ext.begin(),ext.end(),ext.begin(),::tolower);
-    if(ext == "bas"){
-      loader->bas(f);
-    }
-    else if(ext == "prg"){
-      loader->prg(f);
+    std::string arg(argv[i]);
+    if(arg == "-r" && i+1 < argc)
+      record = argv[++i];
+    else if(arg == "-p" && i+1 < argc)
+      replay = argv[++i];
+    else if(arg == "-s" && i+1 < argc)
+      seek = std::stoul(argv[++i]);
+    else if(arg == "-S" && i+1 < argc)
+      speed = std::stoul(argv[++i]);
+    else if(arg == "-W")
+      warp = true;
+    else if(arg == "-k" && i+1 < argc)
+      sscanf(argv[++i],"%u/%u",&skip,&skip_period);
+    else if(arg == "-a")
+      adaptive_skip = true;
+    else if(arg == "-R" && i+1 < argc)
+      rewind_seconds = std::stoul(argv[++i]);
+    else
+      program = arg;
+  }
+  SdlSink *sink = new SdlSink();
+  sink->governor()->speed(speed);
+  sink->governor()->warp(warp);
+  C64 *c64 = new C64(sink);
+  c64->vic()->frame_skip(skip,skip_period);
+  if(adaptive_skip)
+    c64->vic()->adaptive_skip(Vic::kAdaptiveSkip);
+  Rewind *rewind = nullptr;
+  if(rewind_seconds)
+  {
+    rewind = new Rewind(c64,(size_t)(rewind_seconds / Vic::kRefreshRate));
+    sink->rewind(rewind);
+  }
+  Loader *loader = nullptr;
+  Recorder *recorder = new Recorder(c64);
+  Player *player = new Player(c64);
+  if(!replay.empty())
+  {
+    /* the recording holds the program already */
+    if(!player->open(replay))
+      std::cerr << "can't replay " << replay << std::endl;
+    else if(seek)
+    {
+      /* fast-forward unpaced and undrawn, then restore the settings */
+      sink->governor()->warp(true);
+      c64->vic()->frame_skip(1,1);
+      if(!player->seek(seek))
+        std::cerr << "can't seek " << replay << " to " << seek << std::endl;
+      c64->vic()->frame_skip(skip,skip_period);
+      sink->governor()->warp(warp);
     }
   }
-}
-
-void wget_cb(const char *f)
-{
-  wget_download_finished = true;
-  load_file(f);
-}
-
-void emscripten_loop()
-{
-  c64->emscripten_loop();
-}
-
-int main(int argc, char **argv)
-{
-  c64 = new C64();
   /* check if asked load a program */
-  if(argc != 1)
+  else if(!program.empty())
   {
     loader = new Loader(c64);
+    /* the loader waits for BASIC, runs whenever the CPU stops */
+    c64->callback([loader,recorder,record]() mutable { 
+      /* start recording once the program is in */
+      if(!loader->emulate() && !record.empty())
+      {
+        if(!recorder->open(record))
+          std::cerr << "can't record to " << record << std::endl;
+        record.clear();
+      }
+      return true;
+    });
 #ifdef EMSCRIPTEN
-    std::string f(argv[1]);
+    std::string f(program);
     size_t sp = f.find_last_of("/");
     if(sp != std::string::npos)
     {
       std::string fname(f.substr(sp+1));
-      c64->callback(emscripten_loader_cb);
-      emscripten_async_wget(argv[1],fname.c_str(),wget_cb,nullptr);
+      emscripten_async_wget2(program.c_str(),fname.c_str(),"GET","",loader,
+                             wget_cb,nullptr,nullptr);
     }
 #else
-    c64->callback(loader_cb);
-    load_file(argv[1]);
+    loader->load(program);
 #endif 
   }
+  else if(!record.empty() && !recorder->open(record))
+    std::cerr << "can't record to " << record << std::endl;
 #ifdef EMSCRIPTEN
-  emscripten_set_main_loop(emscripten_loop,0,0);
+  emscripten_set_main_loop_arg(emscripten_loop,c64,0,0);
 #else
-  c64->start();
+  /* emulation runs on its own thread, this one handles the window */
+  sink->run([c64](){ c64->start(); });
+  delete rewind;
+  delete recorder;
+  delete player;
+  delete loader;
+  delete c64;
+  delete sink;
 #endif
   return 0;
 }
@@ -16,23 +16,34 @@
  */
 
 #include <fstream>
+#include <algorithm>
 #include "memory.h"
 #include "util.h"
 #include "vic.h"
 #include "cia1.h"
 #include "cia2.h"
+#include "rom.h"
 
 Memory::Memory()
 {
   /**
-   * 64 kB memory buffers, zeroed.
+   * 64 kB memory buffers, RAM is zeroed.
    *
    * We use two buffers to handle special circumstances, for instance,
    * any write to a ROM-mapped location will in turn store data on the 
    * hidden RAM, this trickery is used in certain graphic modes.
+   *
+   * ROM is read-only and shared by every instance, see Rom.
    */
   mem_ram_ = new uint8_t[kMemSize]();
-  mem_rom_ = new uint8_t[kMemSize]();
+  mem_rom_ = Rom::shared().data();
+  banks_ = kBankModes[0];
+  vic_bank(0);
+  std::fill(code_pages_,code_pages_+sizeof(code_pages_),false);
+  std::fill(code_gen_,code_gen_+256,0);
+  /* map everything to RAM, bank switching remaps what changes */
+  for(unsigned int p=0 ; p < 256 ; p++)
+    map_page(p);
   /* configure memory layout */
   setup_memory_banks(kLORAM|kHIRAM|kCHAREN);
   /* configure data directional bits */
@@ -42,42 +53,81 @@ Memory::Memory()
 Memory::~Memory()
 {
   delete [] mem_ram_;
-  delete [] mem_rom_;
 }
 
+// bank switching ///////////////////////////////////////////////////////////
+
+/**
+ * @brief PLA memory configurations
+ *
+ * Indexed by the five latch bits EXROM/GAME/CHAREN/HIRAM/LORAM, one 
+ * entry per 4/28/8/8/4/4/8 kB area ($0000,$1000,$8000,$A000,$C000,
+ * $D000 and $E000).
+ */
+const uint8_t Memory::kBankModes[32][7] =
+{
+  /* EXROM=0 GAME=0 */
+  {kRAM,kRAM,kRAM,kRAM,kRAM,kRAM,kRAM},
+  {kRAM,kRAM,kRAM,kRAM,kRAM,kRAM,kRAM},
+  {kRAM,kRAM,kRAM,kCART,kRAM,kROM,kROM},
+  {kRAM,kRAM,kCART,kCART,kRAM,kROM,kROM},
+  {kRAM,kRAM,kRAM,kRAM,kRAM,kRAM,kRAM},
+  {kRAM,kRAM,kRAM,kRAM,kRAM,kIO,kRAM},
+  {kRAM,kRAM,kRAM,kCART,kRAM,kIO,kROM},
+  {kRAM,kRAM,kCART,kCART,kRAM,kIO,kROM},
+  /* EXROM=0 GAME=1 */
+  {kRAM,kRAM,kRAM,kRAM,kRAM,kRAM,kRAM},
+  {kRAM,kRAM,kRAM,kRAM,kRAM,kROM,kRAM},
+  {kRAM,kRAM,kRAM,kRAM,kRAM,kROM,kROM},
+  {kRAM,kRAM,kCART,kROM,kRAM,kROM,kROM},
+  {kRAM,kRAM,kRAM,kRAM,kRAM,kRAM,kRAM},
+  {kRAM,kRAM,kRAM,kRAM,kRAM,kIO,kRAM},
+  {kRAM,kRAM,kRAM,kRAM,kRAM,kIO,kROM},
+  {kRAM,kRAM,kCART,kROM,kRAM,kIO,kROM},
+  /* EXROM=1 GAME=0, ultimax */
+  {kRAM,kNONE,kCART,kNONE,kNONE,kIO,kCART},
+  {kRAM,kNONE,kCART,kNONE,kNONE,kIO,kCART},
+  {kRAM,kNONE,kCART,kNONE,kNONE,kIO,kCART},
+  {kRAM,kNONE,kCART,kNONE,kNONE,kIO,kCART},
+  {kRAM,kNONE,kCART,kNONE,kNONE,kIO,kCART},
+  {kRAM,kNONE,kCART,kNONE,kNONE,kIO,kCART},
+  {kRAM,kNONE,kCART,kNONE,kNONE,kIO,kCART},
+  {kRAM,kNONE,kCART,kNONE,kNONE,kIO,kCART},
+  /* EXROM=1 GAME=1, no cartridge */
+  {kRAM,kRAM,kRAM,kRAM,kRAM,kRAM,kRAM},
+  {kRAM,kRAM,kRAM,kRAM,kRAM,kROM,kRAM},
+  {kRAM,kRAM,kRAM,kRAM,kRAM,kROM,kROM},
+  {kRAM,kRAM,kRAM,kROM,kRAM,kROM,kROM},
+  {kRAM,kRAM,kRAM,kRAM,kRAM,kRAM,kRAM},
+  {kRAM,kRAM,kRAM,kRAM,kRAM,kIO,kRAM},
+  {kRAM,kRAM,kRAM,kRAM,kRAM,kIO,kROM},
+  {kRAM,kRAM,kRAM,kROM,kRAM,kIO,kROM},
+};
+
 /**
  * @brief configure memory banks
  *
  * There are five latch bits that control the configuration allowing
- * for a total of 32 different memory layouts, for now we only take
- * in count three bits : HIRAM/LORAM/CHAREN
+ * for a total of 32 different memory layouts, three of them come from
+ * the processor port (HIRAM/LORAM/CHAREN) and two from the expansion
+ * port (GAME/EXROM). There is no expansion port yet so both lines are
+ * pulled up.
+ *
+ * All layouts are precomputed (see kBankModes) and ROMs are loaded 
+ * once per process (see Rom), a bank switch only remaps the areas 
+ * that changed.
  */
 void Memory::setup_memory_banks(uint8_t v)
 {
-  /* get config bits */
-  bool hiram  = ((v&kHIRAM) != 0);
-  bool loram  = ((v&kLORAM) != 0);
-  bool charen = ((v&kCHAREN)!= 0);
-  /* init everything to ram */
-  for(size_t i=0 ; i < sizeof(banks_) ; i++)
-    banks_[i] = kRAM;
-  /* load ROMs */
-  load_rom("basic.901226-01.bin",kBaseAddrBasic);
-  load_rom("characters.901225-01.bin",kBaseAddrChars);
-  load_rom("kernal.901227-03.bin",kBaseAddrKernal);
-  /* kernal */
-  if (hiram) 
-    banks_[kBankKernal] = kROM;
-  /* basic */
-  if (loram && hiram) 
-    banks_[kBankBasic] = kROM;
-  /* charen */
-  if (charen && (loram || hiram))
-    banks_[kBankCharen] = kIO;
-  else if (charen && !loram && !hiram)
-    banks_[kBankCharen] = kRAM;
-  else 
-    banks_[kBankCharen] = kROM;
+  const uint8_t *prev_banks = banks_;
+  banks_ = kBankModes[(v & (kLORAM|kHIRAM|kCHAREN)) | kGAME | kEXROM];
+  /* code decoded from the switched areas is no longer valid */
+  if(banks_[kBankBasic] != prev_banks[kBankBasic])
+    invalidate_code(kAddrBasicFirstPage>>8,kAddrBasicLastPage>>8);
+  if(banks_[kBankCharen] != prev_banks[kBankCharen])
+    invalidate_code(kAddrVicFirstPage>>8,kAddrCIA2Page>>8);
+  if(banks_[kBankKernal] != prev_banks[kBankKernal])
+    invalidate_code(kAddrKernalFirstPage>>8,kAddrKernalLastPage>>8);
   /* write the config to the zero page */
   write_byte_no_io(kAddrMemoryLayout, v);
 }
@@ -87,109 +137,49 @@ void Memory::setup_memory_banks(uint8_t v)
  */
 void Memory::write_byte_no_io(uint16_t addr, uint8_t v)
 {
+  code_written(addr);
   mem_ram_[addr] = v;
 }
 
 /**
- * @brief writes a byte to RAM handling I/O
+ * @brief writes a byte the page table can't handle
+ *
+ * Called from write_byte() for I/O pages, pages holding decoded code 
+ * and the memory layout register.
  */
-void Memory::write_byte(uint16_t addr, uint8_t v)
+void Memory::write_io(uint16_t addr, uint8_t v)
 {
   uint16_t page = addr&0xff00;
-  /* ZP */
-  if (page == kAddrZeroPage)
-  {
-    /* bank switching */
-    if (addr == kAddrMemoryLayout)
-      setup_memory_banks(v);
-    else
-      mem_ram_[addr] = v;
-  }
-  /* VIC-II DMA or Character ROM */
-  else if (page >= kAddrVicFirstPage && page <= kAddrVicLastPage)
-  {
-    if(banks_[kBankCharen] == kIO)
-      vic_->write_register(addr&0x7f,v);
-    else
-      mem_ram_[addr] = v;
-  }
+  code_written(addr);
+  /* bank switching */
+  if (addr == kAddrMemoryLayout)
+    setup_memory_banks(v);
+  /* RAM */
+  else if (write_map_[page>>8] != nullptr)
+    write_map_[page>>8][addr] = v;
   /* CIA1 */
   else if (page == kAddrCIA1Page)
-  {
-    if(banks_[kBankCharen] == kIO)
-      cia1_->write_register(addr&0x0f,v);
-    else
-      mem_ram_[addr] = v;
-  }
+    cia1_->write_register(addr&0x0f,v);
+  /* CIA2 */
   else if (page == kAddrCIA2Page)
-  {
-    if(banks_[kBankCharen] == kIO)
-      cia2_->write_register(addr&0x0f,v);
-    else
-      mem_ram_[addr] = v;
-  }
-  /* default */
+    cia2_->write_register(addr&0x0f,v);
+  /* VIC-II */
   else
-  {
-    mem_ram_[addr] = v;
-  }
+    vic_->write_register(addr&0x7f,v);
 }
 
 /**
- * @brief reads a byte from RAM or ROM (depending on bank config)
+ * @brief reads a byte from an I/O page
  */
-uint8_t Memory::read_byte(uint16_t addr)
+uint8_t Memory::read_io(uint16_t addr)
 {
-  uint8_t  retval = 0;
-  uint16_t page   = addr&0xff00;
-  /* VIC-II DMA or Character ROM */
-  if (page >= kAddrVicFirstPage && page <= kAddrVicLastPage)
-  {
-    if(banks_[kBankCharen] == kIO)
-      retval = vic_->read_register(addr&0x7f);
-    else if(banks_[kBankCharen] == kROM)
-      retval = mem_rom_[addr];
-    else
-      retval = mem_ram_[addr];
-  }
-  /* CIA1 */
-  else if (page == kAddrCIA1Page)
-  {
-    if(banks_[kBankCharen] == kIO)
-      retval = cia1_->read_register(addr&0x0f);
-    else
-      retval = mem_ram_[addr];
-  }
-  /* CIA2 */
+  uint16_t page = addr&0xff00;
+  if (page == kAddrCIA1Page)
+    return cia1_->read_register(addr&0x0f);
   else if (page == kAddrCIA2Page)
-  {
-    if(banks_[kBankCharen] == kIO)
-      retval = cia2_->read_register(addr&0x0f);
-    else
-      retval = mem_ram_[addr];
-  }       
-  /* BASIC or RAM */
-  else if (page >= kAddrBasicFirstPage && page <= kAddrBasicLastPage)
-  {
-    if (banks_[kBankBasic] == kROM)
-      retval = mem_rom_[addr];
-    else
-      retval = mem_ram_[addr];
-  }
-  /* KERNAL */
-  else if (page >= kAddrKernalFirstPage && page <= kAddrKernalLastPage)
-  {
-    if (banks_[kBankKernal] == kROM)
-      retval = mem_rom_[addr];
-    else 
-      retval = mem_ram_[addr];
-  }
-  /* default */
+    return cia2_->read_register(addr&0x0f);
   else
-  {
-    retval = mem_ram_[addr];
-  }
-  return retval;
+    return vic_->read_register(addr&0x7f);
 }
 
 /**
@@ -236,62 +226,139 @@ void Memory::write_word_no_io(uint16_t addr, uint16_t v)
 }
 
 /**
- * @brief read byte (from VIC's perspective)
- *
- * The VIC has only 14 address lines so it can only access 
- * 16kB of memory at once, the two missing address bits are 
- * provided by CIA2.
+ * @brief selects the 16 kB bank the VIC sees
  *
- * The VIC always reads from RAM ignoring the memory configuration,
- * there's one exception: the character generator ROM. Unless the 
- * Ultimax mode is selected, VIC sees the character generator ROM 
- * in the memory areas:
- *
- *  1000-1FFF
- *  9000-9FFF
+ * Called by CIA2 whenever port A changes, so vic_read_byte() doesn't 
+ * have to ask for the bank on every access. The character generator
+ * ROM only shows up in banks 0 and 2.
  */
-uint8_t Memory::vic_read_byte(uint16_t addr)
+void Memory::vic_bank(uint16_t base)
 {
-  uint8_t v;
-  uint16_t vic_addr = cia2_->vic_base_address() + (addr & 0x3fff);
-  if((vic_addr >= 0x1000 && vic_addr <  0x2000) ||
-     (vic_addr >= 0x9000 && vic_addr <  0xa000))
-    v = mem_rom_[kBaseAddrChars + (vic_addr & 0xfff)];
-  else
-    v = read_byte_no_io(vic_addr);
-  return v;
+  vic_bank_ = mem_ram_ + base;
+  vic_chargen_ = (base & 0x4000) == 0;
 }
 
 /**
- * @brief loads a external binary into ROM
+ * @brief loads a external binary into RAM
  */
-void Memory::load_rom(const std::string &f, uint16_t baseaddr)
+void Memory::load_ram(const std::string &f, uint16_t baseaddr)
 {
-  std::string path = "./assets/roms/" + f;
+  std::string path = "./assets/" + f;
   std::ifstream is(path, std::ios::in | std::ios::binary);
   if(is)
   {
     is.seekg (0, is.end);
     std::streamoff length = is.tellg();
     is.seekg (0, is.beg);
-    is.read ((char *) &mem_rom_[baseaddr],length);
+    is.read ((char *) &mem_ram_[baseaddr],length);
+    std::streamoff last = std::min<std::streamoff>(baseaddr+length,kMemSize)-1;
+    invalidate_code(baseaddr>>8,last>>8);
   }
 }
 
+// decoded code tracking ////////////////////////////////////////////////////
+
 /**
- * @brief loads a external binary into RAM
+ * @brief point the page table entries of a page at its backing storage
+ *
+ * Entries are indexed with the full address, pages without an entry
+ * (nullptr) are handled by read_io()/write_io(): I/O pages and, for 
+ * writes, pages holding decoded code so that code_written() sees them.
  */
-void Memory::load_ram(const std::string &f, uint16_t baseaddr)
+void Memory::map_page(uint8_t page)
 {
-  std::string path = "./assets/" + f;
-  std::ifstream is(path, std::ios::in | std::ios::binary);
-  if(is)
+  uint16_t addr = page << 8;
+  const uint8_t *r = mem_ram_;
+  uint8_t *w = mem_ram_;
+  /* VIC-II DMA or Character ROM */
+  if (addr >= kAddrVicFirstPage && addr <= kAddrVicLastPage)
   {
-    is.seekg (0, is.end);
-    std::streamoff length = is.tellg();
-    is.seekg (0, is.beg);
-    is.read ((char *) &mem_ram_[baseaddr],length);
+    if(banks_[kBankCharen] == kIO)
+      r = w = nullptr;
+    else if(banks_[kBankCharen] == kROM)
+      r = mem_rom_;
   }
+  /* CIA1 and CIA2 */
+  else if (addr == kAddrCIA1Page || addr == kAddrCIA2Page)
+  {
+    if(banks_[kBankCharen] == kIO)
+      r = w = nullptr;
+  }
+  /* BASIC or cartridge ROMH */
+  else if (addr >= kAddrBasicFirstPage && addr <= kAddrBasicLastPage)
+  {
+    if (banks_[kBankBasic] == kROM)
+      r = mem_rom_;
+  }
+  /* KERNAL */
+  else if (addr >= kAddrKernalFirstPage && addr <= kAddrKernalLastPage)
+  {
+    if (banks_[kBankKernal] == kROM)
+      r = mem_rom_;
+  }
+  if(code_pages_[page])
+    w = nullptr;
+  read_map_[page] = r;
+  write_map_[page] = w;
+}
+
+/**
+ * @brief bump the generation of a page if the CPU decoded code from it
+ *
+ * The CPU caches decoded instruction blocks, tagged with the generation 
+ * of the page they were decoded from, any write to a watched page makes 
+ * those blocks stale. Pages are only watched again once new code is 
+ * decoded from them so plain data writes stay cheap.
+ */
+void Memory::code_written(uint16_t addr)
+{
+  uint8_t page = addr >> 8;
+  if(code_pages_[page])
+  {
+    code_pages_[page] = false;
+    code_gen_[page]++;
+    map_page(page);
+  }
+}
+
+/**
+ * @brief invalidate decoded code in a range of pages (both inclusive)
+ *
+ * Also remaps the pages, bank switching relies on this.
+ */
+void Memory::invalidate_code(uint8_t first_page, uint8_t last_page)
+{
+  for(unsigned int p=first_page ; p <= last_page ; p++)
+  {
+    code_pages_[p] = false;
+    code_gen_[p]++;
+    map_page(p);
+  }
+}
+
+// save states ///////////////////////////////////////////////////////////////
+
+/**
+ * @brief copies RAM out, see C64::save_state()
+ *
+ * ROM is shared and never changes, the bank configuration is kept in
+ * RAM ($01) so there is nothing else to save.
+ */
+void Memory::save(State *s)
+{
+  std::copy(mem_ram_,mem_ram_+kMemSize,s->ram);
+}
+
+/**
+ * @brief restores a state saved with save()
+ *
+ * All decoded code is dropped and every page remapped.
+ */
+void Memory::load(const State &s)
+{
+  std::copy(s.ram,s.ram+kMemSize,mem_ram_);
+  setup_memory_banks(mem_ram_[kAddrMemoryLayout]);
+  invalidate_code(0x00,0xff);
 }
 
 // debug ////////////////////////////////////////////////////////////////////
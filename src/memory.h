@@ -49,14 +49,30 @@ class Sid;
  */
 class Memory
 {
+#if defined(CPU_JIT)
+  friend class Jit;
+#endif
   private:
     uint8_t *mem_ram_;
-    uint8_t *mem_rom_;
-    uint8_t banks_[7];
+    const uint8_t *mem_rom_;
+    const uint8_t *banks_;
     Vic *vic_;
     Cia1 *cia1_;
     Cia2 *cia2_;
     Sid *sid_;
+    /* decoded code tracking */
+    bool code_pages_[256];
+    uint32_t code_gen_[256];
+    inline void code_written(uint16_t addr);
+    /* page tables, indexed by the full address, nullptr means I/O */
+    const uint8_t *read_map_[256];
+    uint8_t *write_map_[256];
+    void map_page(uint8_t page);
+    /* vic bank, see vic_bank() */
+    const uint8_t *vic_bank_;
+    bool vic_chargen_;
+    uint8_t read_io(uint16_t addr);
+    void write_io(uint16_t addr, uint8_t v);
   public:
     Memory();
     ~Memory();
@@ -68,7 +84,10 @@ class Memory
     {
       kROM,
       kRAM,
-      kIO
+      kIO,
+      /* no expansion port yet, these read and write RAM */
+      kCART,
+      kNONE
     };
     enum Banks
     {
@@ -76,21 +95,35 @@ class Memory
       kBankCharen = 5,
       kBankKernal =  6,
     };
+    static const uint8_t kBankModes[32][7];
     void setup_memory_banks(uint8_t v);
     /* read/write memory */
-    uint8_t read_byte(uint16_t addr);
+    inline uint8_t read_byte(uint16_t addr);
     uint8_t read_byte_no_io(uint16_t addr);
-    void write_byte(uint16_t addr, uint8_t v);
+    inline void write_byte(uint16_t addr, uint8_t v);
     void write_byte_no_io(uint16_t addr, uint8_t v);
     uint16_t read_word(uint16_t addr);
     uint16_t read_word_no_io(uint16_t);
     void write_word(uint16_t addr, uint16_t v);
     void write_word_no_io(uint16_t addr, uint16_t v);
     /* vic memory access */
-    uint8_t vic_read_byte(uint16_t addr);
+    void vic_bank(uint16_t base);
+    inline uint8_t vic_read_byte(uint16_t addr);
     uint8_t read_byte_rom(uint16_t addr);
+    /* decoded code tracking, see Cpu::lookup_block() */
+    inline uint32_t code_generation(uint8_t page){return code_gen_[page];};
+    inline void watch_code_page(uint8_t page)
+      {code_pages_[page] = true; write_map_[page] = nullptr;};
+    void invalidate_code(uint8_t first_page, uint8_t last_page);
+    inline bool io_page(uint8_t page){return read_map_[page] == nullptr;};
+    /* save states */
+    struct State
+    {
+      uint8_t ram[0x10000];
+    };
+    void save(State *s);
+    void load(const State &s);
     /* load external binaries */
-    void load_rom(const std::string &f, uint16_t baseaddr);
     void load_ram(const std::string &f, uint16_t baseaddr);
     /* debug */
     void dump();
@@ -125,6 +158,61 @@ class Memory
     static const uint8_t kLORAM  = 1 << 0;
     static const uint8_t kHIRAM  = 1 << 1;
     static const uint8_t kCHAREN = 1 << 2;
+    static const uint8_t kGAME   = 1 << 3;
+    static const uint8_t kEXROM  = 1 << 4;
 };
 
+// inline memory access /////////////////////////////////////////////////////
+
+/**
+ * @brief reads a byte from RAM or ROM (depending on bank config)
+ *
+ * The page table is rebuilt on bank switches so this is a single 
+ * indexed load unless the page is mapped to I/O.
+ */
+uint8_t Memory::read_byte(uint16_t addr)
+{
+  const uint8_t *m = read_map_[addr>>8];
+  if(m != nullptr)
+    return m[addr];
+  return read_io(addr);
+}
+
+/**
+ * @brief writes a byte to RAM handling I/O
+ *
+ * Writes to ROM-mapped locations land in the RAM underneath.
+ */
+void Memory::write_byte(uint16_t addr, uint8_t v)
+{
+  uint8_t *m = write_map_[addr>>8];
+  if(m != nullptr && addr != kAddrMemoryLayout)
+    m[addr] = v;
+  else
+    write_io(addr,v);
+}
+
+/**
+ * @brief read byte (from VIC's perspective)
+ *
+ * The VIC has only 14 address lines so it can only access 
+ * 16kB of memory at once, the two missing address bits are 
+ * provided by CIA2, see vic_bank().
+ *
+ * The VIC always reads from RAM ignoring the memory configuration,
+ * there's one exception: the character generator ROM. Unless the 
+ * Ultimax mode is selected, VIC sees the character generator ROM 
+ * in the memory areas:
+ *
+ *  1000-1FFF
+ *  9000-9FFF
+ */
+uint8_t Memory::vic_read_byte(uint16_t addr)
+{
+  addr &= 0x3fff;
+  if(vic_chargen_ && (addr & 0xf000) == 0x1000)
+    return mem_rom_[kBaseAddrChars + (addr & 0xfff)];
+  return vic_bank_[addr];
+}
+
 #endif
@@ -0,0 +1,436 @@
+/*
+ * emudore, Commodore 64 emulator
+ * Copyright (c) 2016, Mario Ballano <mballano@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @brief MOS 6510 opcode table
+ *
+ * This file is meant to be included multiple times, it lists all
+ * 256 opcodes in order so the different dispatch engines in cpu.cpp
+ * can be generated from a single source. Before including it define:
+ *
+ * - OPCODE(op,len,insn) : opcode op is len bytes long and is
+ *                        emulated by expression insn
+ * - ILLEGAL(op)         : opcode op is unknown or not implemented
+ */
+
+/* BRK */
+OPCODE(0x00, 1, brk())
+/* ORA (nn,X) */
+OPCODE(0x01, 2, ora(load_byte(addr_indx()),6))
+ILLEGAL(0x02)
+ILLEGAL(0x03)
+ILLEGAL(0x04)
+/* ORA nn */
+OPCODE(0x05, 2, ora(load_byte(addr_zero()),3))
+/* ASL nn */
+OPCODE(0x06, 2, asl_mem(addr_zero(),5))
+ILLEGAL(0x07)
+/* PHP */
+OPCODE(0x08, 1, php())
+/* ORA #nn */
+OPCODE(0x09, 2, ora(fetch_op(),2))
+/* ASL A */
+OPCODE(0x0A, 1, asl_a())
+ILLEGAL(0x0B)
+ILLEGAL(0x0C)
+/* ORA nnnn */
+OPCODE(0x0D, 3, ora(load_byte(addr_abs()),4))
+/* ASL nnnn */
+OPCODE(0x0E, 3, asl_mem(addr_abs(),6))
+ILLEGAL(0x0F)
+/* BPL nn */
+OPCODE(0x10, 2, bpl())
+/* ORA (nn,Y) */
+OPCODE(0x11, 2, ora(load_byte(addr_indy()),5))
+ILLEGAL(0x12)
+ILLEGAL(0x13)
+ILLEGAL(0x14)
+/* ORA nn,X */
+OPCODE(0x15, 2, ora(load_byte(addr_zerox()),4))
+/* ASL nn,X */
+OPCODE(0x16, 2, asl_mem(addr_zerox(),6))
+ILLEGAL(0x17)
+/* CLC */
+OPCODE(0x18, 1, clc())
+/* ORA nnnn,Y */
+OPCODE(0x19, 3, ora(load_byte(addr_absy()),4))
+ILLEGAL(0x1A)
+ILLEGAL(0x1B)
+ILLEGAL(0x1C)
+/* ORA nnnn,X */
+OPCODE(0x1D, 3, ora(load_byte(addr_absx()),4))
+/* ASL nnnn,X */
+OPCODE(0x1E, 3, asl_mem(addr_absx(),7))
+ILLEGAL(0x1F)
+/* JSR */
+OPCODE(0x20, 3, jsr())
+/* AND (nn,X) */
+OPCODE(0x21, 2, _and(load_byte(addr_indx()),6))
+ILLEGAL(0x22)
+ILLEGAL(0x23)
+/* BIT nn */
+OPCODE(0x24, 2, bit(addr_zero(),3))
+/* AND nn */
+OPCODE(0x25, 2, _and(load_byte(addr_zero()),3))
+/* ROL nn */
+OPCODE(0x26, 2, rol_mem(addr_zero(),5))
+ILLEGAL(0x27)
+/* PLP */
+OPCODE(0x28, 1, plp())
+/* AND #nn */
+OPCODE(0x29, 2, _and(fetch_op(),2))
+/* ROL A */
+OPCODE(0x2A, 1, rol_a())
+ILLEGAL(0x2B)
+/* BIT nnnn */
+OPCODE(0x2C, 3, bit(addr_abs(),4))
+/* AND nnnn */
+OPCODE(0x2D, 3, _and(load_byte(addr_abs()),4))
+/* ROL nnnn */
+OPCODE(0x2E, 3, rol_mem(addr_abs(),6))
+ILLEGAL(0x2F)
+/* BMI nn */
+OPCODE(0x30, 2, bmi())
+/* AND (nn,Y) */
+OPCODE(0x31, 2, _and(load_byte(addr_indy()),5))
+ILLEGAL(0x32)
+ILLEGAL(0x33)
+ILLEGAL(0x34)
+/* AND nn,X */
+OPCODE(0x35, 2, _and(load_byte(addr_zerox()),4))
+/* ROL nn,X */
+OPCODE(0x36, 2, rol_mem(addr_zerox(),6))
+ILLEGAL(0x37)
+/* SEC */
+OPCODE(0x38, 1, sec())
+/* AND nnnn,Y */
+OPCODE(0x39, 3, _and(load_byte(addr_absy()),4))
+ILLEGAL(0x3A)
+ILLEGAL(0x3B)
+ILLEGAL(0x3C)
+/* AND nnnn,X */
+OPCODE(0x3D, 3, _and(load_byte(addr_absx()),4))
+/* ROL nnnn,X */
+OPCODE(0x3E, 3, rol_mem(addr_absx(),7))
+ILLEGAL(0x3F)
+/* RTI */
+OPCODE(0x40, 1, rti())
+/* EOR (nn,X) */
+OPCODE(0x41, 2, eor(load_byte(addr_indx()),6))
+ILLEGAL(0x42)
+ILLEGAL(0x43)
+ILLEGAL(0x44)
+/* EOR nn */
+OPCODE(0x45, 2, eor(load_byte(addr_zero()),3))
+/* LSR nn */
+OPCODE(0x46, 2, lsr_mem(addr_zero(),5))
+ILLEGAL(0x47)
+/* PHA */
+OPCODE(0x48, 1, pha())
+/* EOR #nn */
+OPCODE(0x49, 2, eor(fetch_op(),2))
+/* LSR A */
+OPCODE(0x4A, 1, lsr_a())
+ILLEGAL(0x4B)
+/* JMP nnnn */
+OPCODE(0x4C, 3, jmp())
+/* EOR nnnn */
+OPCODE(0x4D, 3, eor(load_byte(addr_abs()),4))
+/* LSR nnnn */
+OPCODE(0x4E, 3, lsr_mem(addr_abs(),6))
+ILLEGAL(0x4F)
+/* BVC */
+OPCODE(0x50, 2, bvc())
+/* EOR (nn,Y) */
+OPCODE(0x51, 2, eor(load_byte(addr_indy()),5))
+ILLEGAL(0x52)
+ILLEGAL(0x53)
+ILLEGAL(0x54)
+/* EOR nn,X */
+OPCODE(0x55, 2, eor(load_byte(addr_zerox()),4))
+/* LSR nn,X */
+OPCODE(0x56, 2, lsr_mem(addr_zerox(),6))
+ILLEGAL(0x57)
+/* CLI */
+OPCODE(0x58, 1, cli())
+/* EOR nnnn,Y */
+OPCODE(0x59, 3, eor(load_byte(addr_absy()),4))
+ILLEGAL(0x5A)
+ILLEGAL(0x5B)
+ILLEGAL(0x5C)
+/* EOR nnnn,X */
+OPCODE(0x5D, 3, eor(load_byte(addr_absx()),4))
+/* LSR nnnn,X */
+OPCODE(0x5E, 3, lsr_mem(addr_absx(),7))
+ILLEGAL(0x5F)
+/* RTS */
+OPCODE(0x60, 1, rts())
+/* ADC (nn,X) */
+OPCODE(0x61, 2, adc(load_byte(addr_indx()),6))
+ILLEGAL(0x62)
+ILLEGAL(0x63)
+ILLEGAL(0x64)
+/* ADC nn */
+OPCODE(0x65, 2, adc(load_byte(addr_zero()),3))
+/* ROR nn */
+OPCODE(0x66, 2, ror_mem(addr_zero(),5))
+ILLEGAL(0x67)
+/* PLA */
+OPCODE(0x68, 1, pla())
+/* ADC #nn */
+OPCODE(0x69, 2, adc(fetch_op(),2))
+/* ROR A */
+OPCODE(0x6A, 1, ror_a())
+ILLEGAL(0x6B)
+/* JMP (nnnn) */
+OPCODE(0x6C, 3, jmp_ind())
+/* ADC nnnn */
+OPCODE(0x6D, 3, adc(load_byte(addr_abs()),4))
+/* ROR nnnn */
+OPCODE(0x6E, 3, ror_mem(addr_abs(),6))
+ILLEGAL(0x6F)
+/* BVS */
+OPCODE(0x70, 2, bvs())
+/* ADC (nn,Y) */
+OPCODE(0x71, 2, adc(load_byte(addr_indy()),5))
+ILLEGAL(0x72)
+ILLEGAL(0x73)
+ILLEGAL(0x74)
+/* ADC nn,X */
+OPCODE(0x75, 2, adc(load_byte(addr_zerox()),4))
+/* ROR nn,X */
+OPCODE(0x76, 2, ror_mem(addr_zerox(),6))
+ILLEGAL(0x77)
+/* SEI */
+OPCODE(0x78, 1, sei())
+/* ADC nnnn,Y */
+OPCODE(0x79, 3, adc(load_byte(addr_absy()),4))
+ILLEGAL(0x7A)
+ILLEGAL(0x7B)
+ILLEGAL(0x7C)
+/* ADC nnnn,X */
+OPCODE(0x7D, 3, adc(load_byte(addr_absx()),4))
+/* ROR nnnn,X */
+OPCODE(0x7E, 3, ror_mem(addr_absx(),7))
+ILLEGAL(0x7F)
+ILLEGAL(0x80)
+/* STA (nn,X) */
+OPCODE(0x81, 2, sta(addr_indx(),6))
+ILLEGAL(0x82)
+ILLEGAL(0x83)
+/* STY nn */
+OPCODE(0x84, 2, sty(addr_zero(),3))
+/* STA nn */
+OPCODE(0x85, 2, sta(addr_zero(),3))
+/* STX nn */
+OPCODE(0x86, 2, stx(addr_zero(),3))
+ILLEGAL(0x87)
+/* DEY */
+OPCODE(0x88, 1, dey())
+ILLEGAL(0x89)
+/* TXA */
+OPCODE(0x8A, 1, txa())
+ILLEGAL(0x8B)
+/* STY nnnn */
+OPCODE(0x8C, 3, sty(addr_abs(),4))
+/* STA nnnn */
+OPCODE(0x8D, 3, sta(addr_abs(),4))
+/* STX nnnn */
+OPCODE(0x8E, 3, stx(addr_abs(),4))
+ILLEGAL(0x8F)
+/* BCC nn */
+OPCODE(0x90, 2, bcc())
+/* STA (nn,Y) */
+OPCODE(0x91, 2, sta(addr_indy(),6))
+ILLEGAL(0x92)
+ILLEGAL(0x93)
+/* STY nn,X */
+OPCODE(0x94, 2, sty(addr_zerox(),4))
+/* STA nn,X */
+OPCODE(0x95, 2, sta(addr_zerox(),4))
+/* STX nn,Y */
+OPCODE(0x96, 2, stx(addr_zeroy(),4))
+ILLEGAL(0x97)
+/* TYA */
+OPCODE(0x98, 1, tya())
+/* STA nnnn,Y */
+OPCODE(0x99, 3, sta(addr_absy(),5))
+/* TXS */
+OPCODE(0x9A, 1, txs())
+ILLEGAL(0x9B)
+ILLEGAL(0x9C)
+/* STA nnnn,X */
+OPCODE(0x9D, 3, sta(addr_absx(),5))
+ILLEGAL(0x9E)
+ILLEGAL(0x9F)
+/* LDY #nn */
+OPCODE(0xA0, 2, ldy(fetch_op(),2))
+/* LDA (nn,X) */
+OPCODE(0xA1, 2, lda(load_byte(addr_indx()),6))
+/* LDX #nn */
+OPCODE(0xA2, 2, ldx(fetch_op(),2))
+ILLEGAL(0xA3)
+/* LDY nn */
+OPCODE(0xA4, 2, ldy(load_byte(addr_zero()),3))
+/* LDA nn */
+OPCODE(0xA5, 2, lda(load_byte(addr_zero()),3))
+/* LDX nn */
+OPCODE(0xA6, 2, ldx(load_byte(addr_zero()),3))
+ILLEGAL(0xA7)
+/* TAY */
+OPCODE(0xA8, 1, tay())
+/* LDA #nn */
+OPCODE(0xA9, 2, lda(fetch_op(),2))
+/* TAX */
+OPCODE(0xAA, 1, tax())
+ILLEGAL(0xAB)
+/* LDY nnnn */
+OPCODE(0xAC, 3, ldy(load_byte(addr_abs()),4))
+/* LDA nnnn */
+OPCODE(0xAD, 3, lda(load_byte(addr_abs()),4))
+/* LDX nnnn */
+OPCODE(0xAE, 3, ldx(load_byte(addr_abs()),4))
+ILLEGAL(0xAF)
+/* BCS nn */
+OPCODE(0xB0, 2, bcs())
+/* LDA (nn,Y) */
+OPCODE(0xB1, 2, lda(load_byte(addr_indy()),5))
+ILLEGAL(0xB2)
+ILLEGAL(0xB3)
+/* LDY nn,X */
+OPCODE(0xB4, 2, ldy(load_byte(addr_zerox()),3))
+/* LDA nn,X */
+OPCODE(0xB5, 2, lda(load_byte(addr_zerox()),3))
+/* LDX nn,Y */
+OPCODE(0xB6, 2, ldx(load_byte(addr_zeroy()),3))
+ILLEGAL(0xB7)
+/* CLV */
+OPCODE(0xB8, 1, clv())
+/* LDA nnnn,Y */
+OPCODE(0xB9, 3, lda(load_byte(addr_absy()),4))
+/* TSX */
+OPCODE(0xBA, 1, tsx())
+ILLEGAL(0xBB)
+/* LDY nnnn,X */
+OPCODE(0xBC, 3, ldy(load_byte(addr_absx()),4))
+/* LDA nnnn,X */
+OPCODE(0xBD, 3, lda(load_byte(addr_absx()),4))
+/* LDX nnnn,Y */
+OPCODE(0xBE, 3, ldx(load_byte(addr_absy()),4))
+ILLEGAL(0xBF)
+/* CPY #nn */
+OPCODE(0xC0, 2, cpy(fetch_op(),2))
+/* CMP (nn,X) */
+OPCODE(0xC1, 2, cmp(load_byte(addr_indx()),6))
+ILLEGAL(0xC2)
+ILLEGAL(0xC3)
+/* CPY nn */
+OPCODE(0xC4, 2, cpy(load_byte(addr_zero()),3))
+/* CMP nn */
+OPCODE(0xC5, 2, cmp(load_byte(addr_zero()),3))
+/* DEC nn */
+OPCODE(0xC6, 2, dec(addr_zero(),5))
+ILLEGAL(0xC7)
+/* INY */
+OPCODE(0xC8, 1, iny())
+/* CMP #nn */
+OPCODE(0xC9, 2, cmp(fetch_op(),2))
+/* DEX */
+OPCODE(0xCA, 1, dex())
+ILLEGAL(0xCB)
+/* CPY nnnn */
+OPCODE(0xCC, 3, cpy(load_byte(addr_abs()),4))
+/* CMP nnnn */
+OPCODE(0xCD, 3, cmp(load_byte(addr_abs()),4))
+/* DEC nnnn */
+OPCODE(0xCE, 3, dec(addr_abs(),6))
+ILLEGAL(0xCF)
+/* BNE nn */
+OPCODE(0xD0, 2, bne())
+/* CMP (nn,Y) */
+OPCODE(0xD1, 2, cmp(load_byte(addr_indy()),5))
+ILLEGAL(0xD2)
+ILLEGAL(0xD3)
+ILLEGAL(0xD4)
+/* CMP nn,X */
+OPCODE(0xD5, 2, cmp(load_byte(addr_zerox()),4))
+/* DEC nn,X */
+OPCODE(0xD6, 2, dec(addr_zerox(),6))
+ILLEGAL(0xD7)
+/* CLD */
+OPCODE(0xD8, 1, cld())
+/* CMP nnnn,Y */
+OPCODE(0xD9, 3, cmp(load_byte(addr_absy()),4))
+ILLEGAL(0xDA)
+ILLEGAL(0xDB)
+ILLEGAL(0xDC)
+/* CMP nnnn,X */
+OPCODE(0xDD, 3, cmp(load_byte(addr_absx()),4))
+/* DEC nnnn,X */
+OPCODE(0xDE, 3, dec(addr_absx(),7))
+ILLEGAL(0xDF)
+/* CPX #nn */
+OPCODE(0xE0, 2, cpx(fetch_op(),2))
+/* SBC (nn,X) */
+OPCODE(0xE1, 2, sbc(load_byte(addr_indx()),6))
+ILLEGAL(0xE2)
+ILLEGAL(0xE3)
+/* CPX nn */
+OPCODE(0xE4, 2, cpx(load_byte(addr_zero()),3))
+/* SBC nn */
+OPCODE(0xE5, 2, sbc(load_byte(addr_zero()),3))
+/* INC nn */
+OPCODE(0xE6, 2, inc(addr_zero(),5))
+ILLEGAL(0xE7)
+/* INX */
+OPCODE(0xE8, 1, inx())
+/* SBC #nn */
+OPCODE(0xE9, 2, sbc(fetch_op(),2))
+/* NOP */
+OPCODE(0xEA, 1, nop())
+ILLEGAL(0xEB)
+/* CPX nnnn */
+OPCODE(0xEC, 3, cpx(load_byte(addr_abs()),4))
+/* SBC nnnn */
+OPCODE(0xED, 3, sbc(load_byte(addr_abs()),4))
+/* INC nnnn */
+OPCODE(0xEE, 3, inc(addr_abs(),6))
+ILLEGAL(0xEF)
+/* BEQ nn */
+OPCODE(0xF0, 2, beq())
+/* SBC (nn,Y) */
+OPCODE(0xF1, 2, sbc(load_byte(addr_indy()),5))
+ILLEGAL(0xF2)
+ILLEGAL(0xF3)
+ILLEGAL(0xF4)
+/* SBC nn,X */
+OPCODE(0xF5, 2, sbc(load_byte(addr_zerox()),4))
+/* INC nn,X */
+OPCODE(0xF6, 2, inc(addr_zerox(),6))
+ILLEGAL(0xF7)
+/* SED */
+OPCODE(0xF8, 1, sed())
+/* SBC nnnn,Y */
+OPCODE(0xF9, 3, sbc(load_byte(addr_absy()),4))
+ILLEGAL(0xFA)
+ILLEGAL(0xFB)
+ILLEGAL(0xFC)
+/* SBC nnnn,X */
+OPCODE(0xFD, 3, sbc(load_byte(addr_absx()),4))
+/* INC nnnn,X */
+OPCODE(0xFE, 3, inc(addr_absx(),7))
+ILLEGAL(0xFF)
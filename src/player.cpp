@@ -0,0 +1,174 @@
+/*
+ * emudore, Commodore 64 emulator
+ * Copyright (c) 2016, Mario Ballano <mballano@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include "player.h"
+
+Player::Player(C64 *c64)
+{
+  c64_ = c64;
+  next_ = 0;
+  state_ = new C64::State();
+}
+
+Player::~Player()
+{
+  close();
+  delete state_;
+}
+
+/**
+ * @brief indexes a recording and restores its first keyframe
+ *
+ * Returns false, leaving the machine untouched, if the file is not
+ * a recording made by a compatible build.
+ */
+bool Player::open(const std::string &f)
+{
+  close();
+  is_.open(f,std::ios::in|std::ios::binary);
+  Recorder::Header h;
+  if(!is_.read((char *)&h,sizeof(h)) ||
+     h.magic != Recorder::kMagic || h.version != Recorder::kVersion ||
+     h.state_size != sizeof(C64::State))
+  {
+    is_.close();
+    return false;
+  }
+  is_.seekg(0,std::ios::end);
+  std::streamoff size = is_.tellg();
+  is_.seekg(sizeof(h),std::ios::beg);
+  uint8_t tag;
+  while(is_.read((char *)&tag,sizeof(tag)))
+  {
+    if(tag == Recorder::kKeyEvent)
+    {
+      Recorder::KeyEvent ev;
+      if(!is_.read((char *)&ev,sizeof(ev)))
+        break;
+      events_.push_back(ev);
+    }
+    else if(tag == Recorder::kKeyframe)
+    {
+      Keyframe k;
+      if(!is_.read((char *)&k.frame,sizeof(k.frame)))
+        break;
+      k.event = events_.size();
+      k.offset = is_.tellg();
+      /* cut short, e.g. by a crash while recording */
+      if(k.offset + (std::streamoff)sizeof(C64::State) > size)
+        break;
+      keyframes_.push_back(k);
+      is_.seekg(sizeof(C64::State),std::ios::cur);
+    }
+    else
+      break;
+  }
+  is_.clear();
+  if(keyframes_.empty() || !seek(keyframes_.front().frame))
+  {
+    close();
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief stops replaying, host input goes through again
+ */
+void Player::close()
+{
+  if(!is_.is_open())
+    return;
+  c64_->io()->player(nullptr);
+  is_.close();
+  events_.clear();
+  keyframes_.clear();
+  next_ = 0;
+}
+
+/**
+ * @brief moves the replay to the end of the given frame
+ *
+ * Restores the closest keyframe at or before it and emulates from 
+ * there, returns false if the recording starts later or the machine
+ * stops on the way.
+ */
+bool Player::seek(unsigned int frame)
+{
+  auto k = std::upper_bound(keyframes_.begin(),keyframes_.end(),frame,
+      [](unsigned int f, const Keyframe &k){return f < k.frame;});
+  if(k == keyframes_.begin())
+    return false;
+  --k;
+  is_.clear();
+  is_.seekg(k->offset);
+  if(!is_.read((char *)state_,sizeof(C64::State)) ||
+     !c64_->load_state(*state_))
+    return false;
+  next_ = k->event;
+  c64_->io()->player(this);
+  while(c64_->vic()->frames() < frame)
+  {
+    if(!c64_->step())
+      return false;
+  }
+  return true;
+}
+
+// replay ////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief whether the next event is due at the current frame and cycle
+ */
+bool Player::due(const Recorder::KeyEvent &ev)
+{
+  uint32_t frame = c64_->vic()->frames();
+  if(ev.frame != frame)
+    return (int32_t)(frame - ev.frame) > 0;
+  return (int)(c64_->cpu()->cycles() - ev.cycle) >= 0;
+}
+
+/**
+ * @brief applies the events due
+ */
+void Player::emulate()
+{
+  while(!finished() && due(events_[next_]))
+  {
+    const Recorder::KeyEvent &ev = events_[next_++];
+    c64_->io()->keyboard_matrix_row(ev.row,ev.value);
+  }
+}
+
+/**
+ * @brief cycles left until the next event
+ *
+ * Events were logged between two CPU runs, stopping the CPU at their
+ * cycle reproduces the recorded run. Events in later frames are only
+ * considered once the VIC-II gets there.
+ */
+int Player::next_event()
+{
+  if(finished())
+    return Cpu::kNoEvent;
+  const Recorder::KeyEvent &ev = events_[next_];
+  uint32_t frame = c64_->vic()->frames();
+  if(ev.frame != frame)
+    return (int32_t)(frame - ev.frame) > 0 ? 0 : Cpu::kNoEvent;
+  return std::max((int)(ev.cycle - c64_->cpu()->cycles()),0);
+}
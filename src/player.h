@@ -0,0 +1,68 @@
+/*
+ * emudore, Commodore 64 emulator
+ * Copyright (c) 2016, Mario Ballano <mballano@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMUDORE_PLAYER_H
+#define EMUDORE_PLAYER_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+
+#include "c64.h"
+#include "recorder.h"
+
+/**
+ * @brief replays a Recorder file
+ *
+ * Restores the first keyframe and from then on feeds the recorded
+ * keyboard matrix writes back at the frame and cycle they were logged
+ * at, host input is ignored meanwhile. Given the same build the
+ * machine goes through exactly the same states as while recording.
+ *
+ * Events are loaded upfront, keyframes are indexed and read on 
+ * demand by seek().
+ */
+class Player
+{
+  private:
+    struct Keyframe
+    {
+      uint32_t frame;
+      size_t event;
+      std::streamoff offset;
+    };
+    C64 *c64_;
+    std::ifstream is_;
+    std::vector<Recorder::KeyEvent> events_;
+    std::vector<Keyframe> keyframes_;
+    size_t next_;
+    C64::State *state_;
+    bool due(const Recorder::KeyEvent &ev);
+  public:
+    Player(C64 *c64);
+    ~Player();
+    bool open(const std::string &f);
+    void close();
+    bool seek(unsigned int frame);
+    bool finished(){return next_ >= events_.size();};
+    unsigned int first_frame(){return keyframes_.front().frame;};
+    /* called by IO */
+    void emulate();
+    int next_event();
+};
+
+#endif
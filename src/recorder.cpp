@@ -0,0 +1,100 @@
+/*
+ * emudore, Commodore 64 emulator
+ * Copyright (c) 2016, Mario Ballano <mballano@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include "recorder.h"
+
+Recorder::Recorder(C64 *c64)
+{
+  c64_ = c64;
+  key_interval_ = kKeyInterval;
+  since_key_ = 0;
+  observer_ = 0;
+  state_ = new C64::State();
+}
+
+Recorder::~Recorder()
+{
+  close();
+  delete state_;
+}
+
+/**
+ * @brief starts recording into f
+ *
+ * Returns false if the file can't be created.
+ */
+bool Recorder::open(const std::string &f, unsigned int key_interval)
+{
+  close();
+  os_.open(f,std::ios::out|std::ios::binary|std::ios::trunc);
+  if(!os_)
+    return false;
+  key_interval_ = std::max(key_interval,1u);
+  Header h = {kMagic,kVersion,sizeof(C64::State),key_interval_};
+  os_.write((const char *)&h,sizeof(h));
+  keyframe();
+  c64_->io()->recorder(this);
+  observer_ = c64_->add_frame_observer([this](){
+    if(++since_key_ >= key_interval_)
+      keyframe();
+  });
+  return true;
+}
+
+/**
+ * @brief stops recording
+ */
+void Recorder::close()
+{
+  if(!os_.is_open())
+    return;
+  c64_->io()->recorder(nullptr);
+  c64_->remove_frame_observer(observer_);
+  observer_ = 0;
+  os_.close();
+}
+
+/**
+ * @brief writes a keyframe, flushing so crashes leave a usable file
+ */
+void Recorder::keyframe()
+{
+  uint8_t tag = kKeyframe;
+  uint32_t frame = c64_->vic()->frames();
+  c64_->save_state(state_);
+  os_.write((const char *)&tag,sizeof(tag));
+  os_.write((const char *)&frame,sizeof(frame));
+  os_.write((const char *)state_,sizeof(C64::State));
+  os_.flush();
+  since_key_ = 0;
+}
+
+/**
+ * @brief logs a keyboard matrix write, see IO::keyboard_matrix_row()
+ */
+void Recorder::key(int row, uint8_t v)
+{
+  uint8_t tag = kKeyEvent;
+  KeyEvent ev = {};
+  ev.frame = c64_->vic()->frames();
+  ev.cycle = c64_->cpu()->cycles();
+  ev.row = row;
+  ev.value = v;
+  os_.write((const char *)&tag,sizeof(tag));
+  os_.write((const char *)&ev,sizeof(ev));
+}
@@ -0,0 +1,92 @@
+/*
+ * emudore, Commodore 64 emulator
+ * Copyright (c) 2016, Mario Ballano <mballano@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMUDORE_RECORDER_H
+#define EMUDORE_RECORDER_H
+
+#include <string>
+#include <fstream>
+#include <cstdint>
+
+#include "c64.h"
+
+/**
+ * @brief keyboard input recorder
+ *
+ * Logs every keyboard matrix write (host keys and typed characters 
+ * alike) keyed by VIC-II frame and CPU cycle, so Player can feed them
+ * back at the exact same point of the emulation.
+ *
+ * The recording starts with a keyframe (a C64::State) and embeds 
+ * another one every key_interval frames, replays can seek to any of 
+ * them instead of emulating from the start, they are written from a
+ * C64 frame observer.
+ *
+ * Anything else done to the machine from the host while recording 
+ * (loading a program, a save state) is not recorded, start recording
+ * once the program has been loaded.
+ *
+ * File format, native endianness and layout like C64 save states:
+ *
+ *  Header
+ *  kKeyframe uint32_t frame, C64::State
+ *  kKeyEvent KeyEvent
+ *  ...
+ */
+class Recorder
+{
+  public:
+    struct Header
+    {
+      uint32_t magic;
+      uint32_t version;
+      uint32_t state_size;
+      uint32_t key_interval;
+    };
+    struct KeyEvent
+    {
+      uint32_t frame;
+      uint32_t cycle;
+      uint8_t row;
+      uint8_t value;
+    };
+    enum kRecord : uint8_t
+    {
+      kKeyEvent = 1,
+      kKeyframe = 2,
+    };
+  private:
+    C64 *c64_;
+    std::ofstream os_;
+    unsigned int key_interval_;
+    unsigned int since_key_;
+    unsigned int observer_;
+    C64::State *state_;
+    void keyframe();
+  public:
+    Recorder(C64 *c64);
+    ~Recorder();
+    bool open(const std::string &f, unsigned int key_interval = kKeyInterval);
+    void close();
+    void key(int row, uint8_t v);
+    /* constants */
+    static const uint32_t kMagic = 0x52344345; /* "EC4R" */
+    static const uint32_t kVersion = 1;
+    static const unsigned int kKeyInterval = 500; /* 10 seconds at 50 Hz */
+};
+
+#endif
@@ -0,0 +1,235 @@
+/*
+ * emudore, Commodore 64 emulator
+ * Copyright (c) 2016, Mario Ballano <mballano@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstring>
+#include <algorithm>
+#include "rewind.h"
+
+/**
+ * @brief creates a rewind buffer keeping the given number of frames
+ */
+Rewind::Rewind(C64 *c64, size_t frames) :
+  cur_(kWords,0),
+  prev_(kWords,0),
+  /* worst case: alternating runs, a word plus two varints each */
+  scratch_(kWords * 8 + (kWords + 1) * 6)
+{
+  c64_ = c64;
+  capacity_ = std::max(frames,(size_t)1);
+  since_key_ = 0;
+  bytes_ = 0;
+  pending_ = false;
+  pending_frames_ = 0;
+  observer_ = c64_->add_frame_observer([this](){ frame(); });
+}
+
+Rewind::~Rewind()
+{
+  c64_->remove_frame_observer(observer_);
+}
+
+// delta encoding ///////////////////////////////////////////////////////////
+
+static inline uint8_t *put_varint(uint8_t *o, size_t v)
+{
+  while(v >= 0x80)
+  {
+    *o++ = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  *o++ = (uint8_t)v;
+  return o;
+}
+
+static inline const uint8_t *get_varint(const uint8_t *i, size_t *v)
+{
+  size_t r = 0;
+  unsigned int shift = 0;
+  while(*i & 0x80)
+  {
+    r |= (size_t)(*i++ & 0x7f) << shift;
+    shift += 7;
+  }
+  *v = r | ((size_t)*i++ << shift);
+  return i;
+}
+
+/**
+ * @brief encodes cur XOR prev (zeros if prev is null) into f
+ *
+ * A sequence of (unchanged words, changed words, XOR of the changed 
+ * words) until the whole state is covered.
+ */
+void Rewind::encode(const uint64_t *cur, const uint64_t *prev, Frame *f)
+{
+  static const uint64_t kZero = 0;
+  size_t step = prev ? 1 : 0;
+  if(!prev)
+    prev = &kZero;
+  uint8_t *o = scratch_.data();
+  size_t i = 0;
+  while(i < kWords)
+  {
+    size_t same = i;
+    while(same < kWords && cur[same] == prev[same*step])
+      same++;
+    size_t diff = same;
+    while(diff < kWords && cur[diff] != prev[diff*step])
+      diff++;
+    o = put_varint(o,same - i);
+    o = put_varint(o,diff - same);
+    for(size_t w=same ; w < diff ; w++)
+    {
+      uint64_t d = cur[w] ^ prev[w*step];
+      memcpy(o,&d,sizeof(d));
+      o += sizeof(d);
+    }
+    i = diff;
+  }
+  f->delta.assign(scratch_.data(),o);
+}
+
+/**
+ * @brief applies a frame encoded by encode() to s
+ */
+void Rewind::decode(const Frame &f, uint64_t *s)
+{
+  const uint8_t *in = f.delta.data();
+  const uint8_t *end = in + f.delta.size();
+  size_t i = 0;
+  while(in < end)
+  {
+    size_t same, diff;
+    in = get_varint(in,&same);
+    in = get_varint(in,&diff);
+    i += same;
+    for(size_t w=0 ; w < diff ; w++)
+    {
+      uint64_t d;
+      memcpy(&d,in,sizeof(d));
+      s[i++] ^= d;
+      in += sizeof(d);
+    }
+  }
+}
+
+// ring //////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief frame observer, rewinds if requested or captures the frame
+ */
+void Rewind::frame()
+{
+  bool rewound = pending_ && !frames_.empty() &&
+    rewind(std::min(pending_frames_,frames_.size() - 1));
+  pending_ = false;
+  if(!rewound)
+    capture();
+}
+
+/**
+ * @brief stores the current machine state
+ *
+ * Called once per frame, see frame().
+ */
+void Rewind::capture()
+{
+  c64_->save_state(state(cur_));
+  Frame f;
+  f.key = frames_.empty() || since_key_ >= kKeyInterval;
+  encode(cur_.data(),f.key ? nullptr : prev_.data(),&f);
+  since_key_ = f.key ? 1 : since_key_ + 1;
+  bytes_ += f.delta.size();
+  frames_.push_back(std::move(f));
+  /* cur_ becomes the reference for the next frame */
+  cur_.swap(prev_);
+  trim();
+}
+
+/**
+ * @brief drops the oldest keyframe interval while enough frames remain
+ */
+void Rewind::trim()
+{
+  while(frames_.size() > capacity_)
+  {
+    size_t next = 1;
+    while(next < frames_.size() && !frames_[next].key)
+      next++;
+    if(frames_.size() - next < capacity_)
+      break;
+    for(size_t i=0 ; i < next ; i++)
+    {
+      bytes_ -= frames_.front().delta.size();
+      frames_.pop_front();
+    }
+  }
+}
+
+/**
+ * @brief restores the machine to the state captured n frames ago
+ *
+ * rewind(0) goes back to the end of the last frame. Later frames are
+ * discarded, capturing resumes from the restored state. Returns false
+ * if fewer than n+1 frames are buffered, or while a Recorder or 
+ * Player is attached: their frame and cycle stamps only move forward.
+ */
+bool Rewind::rewind(size_t n)
+{
+  if(n >= frames_.size() ||
+     c64_->io()->recorder() || c64_->io()->player())
+    return false;
+  size_t target = frames_.size() - 1 - n;
+  size_t key = target;
+  while(!frames_[key].key)
+    key--;
+  std::fill(prev_.begin(),prev_.end(),0);
+  for(size_t i=key ; i <= target ; i++)
+    decode(frames_[i],prev_.data());
+  if(!c64_->load_state(*state(prev_)))
+    return false;
+  while(frames_.size() > target + 1)
+  {
+    bytes_ -= frames_.back().delta.size();
+    frames_.pop_back();
+  }
+  since_key_ = target - key + 1;
+  return true;
+}
+
+/**
+ * @brief rewinds n frames (or as far as buffered) at the end of frame
+ *
+ * For callers running in the middle of a frame, such as a Sink's 
+ * refresh() or IO, where the machine state can't be swapped under 
+ * the chips.
+ */
+void Rewind::request(size_t n)
+{
+  pending_ = true;
+  pending_frames_ = n;
+}
+
+/**
+ * @brief drops every buffered frame
+ */
+void Rewind::clear()
+{
+  frames_.clear();
+  since_key_ = 0;
+  bytes_ = 0;
+}
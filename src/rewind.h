@@ -0,0 +1,83 @@
+/*
+ * emudore, Commodore 64 emulator
+ * Copyright (c) 2016, Mario Ballano <mballano@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMUDORE_REWIND_H
+#define EMUDORE_REWIND_H
+
+#include <deque>
+#include <vector>
+#include <cstdint>
+
+#include "c64.h"
+
+/**
+ * @brief rewind buffer
+ *
+ * Keeps the machine state of the last frames in a bounded ring, 
+ * captured whenever the VIC-II completes a frame (from a C64 frame 
+ * observer).
+ *
+ * Each frame is stored as the XOR of its C64::State with the previous
+ * frame, run-length encoded in 64-bit words, so only what changed 
+ * takes space. Every kKeyInterval frames a keyframe (XOR with zeros)
+ * bounds the work needed to rebuild a frame, frames are dropped a 
+ * keyframe interval at a time once the ring is full.
+ *
+ * Rewinding is refused while recording or replaying (see rewind()).
+ */
+class Rewind
+{
+  private:
+    struct Frame
+    {
+      bool key;
+      std::vector<uint8_t> delta;
+    };
+    C64 *c64_;
+    unsigned int observer_;
+    bool pending_;
+    size_t pending_frames_;
+    std::deque<Frame> frames_;
+    size_t capacity_;
+    size_t since_key_;
+    size_t bytes_;
+    /* states as words, State is padded to a multiple of 8 */
+    std::vector<uint64_t> cur_;
+    std::vector<uint64_t> prev_;
+    std::vector<uint8_t> scratch_;
+    C64::State *state(std::vector<uint64_t> &v)
+      {return reinterpret_cast<C64::State*>(v.data());};
+    void encode(const uint64_t *cur, const uint64_t *prev, Frame *f);
+    void decode(const Frame &f, uint64_t *s);
+    void trim();
+    void frame();
+  public:
+    Rewind(C64 *c64, size_t frames = kDefaultFrames);
+    ~Rewind();
+    void capture();
+    bool rewind(size_t n);
+    void request(size_t n);
+    void clear();
+    size_t frames() const {return frames_.size();};
+    size_t bytes() const {return bytes_;};
+    /* constants */
+    static const size_t kDefaultFrames = 500; /* 10 seconds at 50 Hz */
+    static const size_t kKeyInterval = 50;
+    static const size_t kWords = (sizeof(C64::State) + 7) / 8;
+};
+
+#endif
@@ -0,0 +1,157 @@
+/*
+ * emudore, Commodore 64 emulator
+ * Copyright (c) 2016, Mario Ballano <mballano@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fstream>
+#include <algorithm>
+#include "rom.h"
+#include "memory.h"
+#if defined(EMBED_ROMS)
+#include "roms.h"
+#endif
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(EMSCRIPTEN)
+#define ROM_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+const char *Rom::kSetFile = "./assets/roms/c64-roms.bin";
+
+Rom::Rom()
+{
+  mapped_ = map(kSetFile);
+  if(!mapped_)
+  {
+    alignas(4096) static uint8_t image[kImageSize];
+    load(image,"basic.901226-01.bin",Memory::kBaseAddrBasic);
+    load(image,"characters.901225-01.bin",Memory::kBaseAddrChars);
+    load(image,"kernal.901227-03.bin",Memory::kBaseAddrKernal);
+    data_ = image;
+  }
+  /* FNV-1a of the ROM areas, identifies the ROM set */
+  hash_ = 14695981039346656037ull;
+  for(size_t a=Memory::kBaseAddrBasic ; a < kImageSize ; a++)
+  {
+    if(a >= Memory::kBaseAddrBasic + 0x2000 && a < Memory::kBaseAddrChars)
+      continue;
+    hash_ ^= data_[a];
+    hash_ *= 1099511628211ull;
+  }
+}
+
+Rom::~Rom()
+{
+#if defined(ROM_MMAP)
+  if(mapped_)
+    munmap((void *)data_,kImageSize);
+#endif
+}
+
+/**
+ * @brief the process-wide image, loaded on first use
+ */
+const Rom &Rom::shared()
+{
+  static Rom rom;
+  return rom;
+}
+
+/**
+ * @brief maps a ROM set read-only
+ *
+ * The whole image is reserved without access rights and each ROM is
+ * then mapped from the file at its address, this needs 4 kB pages.
+ */
+bool Rom::map(const std::string &path)
+{
+#if defined(ROM_MMAP)
+  static const struct
+  {
+    uint16_t addr;
+    off_t offset;
+    size_t length;
+  } kAreas[] =
+  {
+    {Memory::kBaseAddrBasic,  0x0000, 0x2000},
+    {Memory::kBaseAddrChars,  0x2000, 0x1000},
+    {Memory::kBaseAddrKernal, 0x3000, 0x2000},
+  };
+  if(sysconf(_SC_PAGESIZE) != 0x1000)
+    return false;
+  int fd = open(path.c_str(),O_RDONLY);
+  if(fd < 0)
+    return false;
+  struct stat st;
+  if(fstat(fd,&st) != 0 || st.st_size != (off_t)kSetSize)
+  {
+    close(fd);
+    return false;
+  }
+  void *base = mmap(nullptr,kImageSize,PROT_NONE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+  if(base == MAP_FAILED)
+  {
+    close(fd);
+    return false;
+  }
+  uint8_t *image = (uint8_t *)base;
+  for(const auto &a : kAreas)
+  {
+    if(mmap(image+a.addr,a.length,PROT_READ,MAP_PRIVATE|MAP_FIXED,
+            fd,a.offset) == MAP_FAILED)
+    {
+      munmap(base,kImageSize);
+      close(fd);
+      return false;
+    }
+  }
+  close(fd);
+  data_ = image;
+  return true;
+#else
+  return false;
+#endif
+}
+
+/**
+ * @brief loads a ROM into the image
+ *
+ * When built with EMBED_ROMS the images compiled into the binary are
+ * used unless the file is found on disk.
+ */
+void Rom::load(uint8_t *image, const std::string &f, uint16_t baseaddr)
+{
+  std::string path = "./assets/roms/" + f;
+  std::ifstream is(path, std::ios::in | std::ios::binary);
+  if(is)
+  {
+    is.seekg (0, is.end);
+    std::streamoff length = is.tellg();
+    is.seekg (0, is.beg);
+    is.read ((char *) &image[baseaddr],length);
+  }
+#if defined(EMBED_ROMS)
+  else
+  {
+    for(const EmbeddedAsset &rom : kEmbeddedRoms)
+    {
+      if(f == rom.name)
+        std::copy(rom.data,rom.data+rom.size,&image[baseaddr]);
+    }
+  }
+#endif
+}
@@ -0,0 +1,58 @@
+/*
+ * emudore, Commodore 64 emulator
+ * Copyright (c) 2016, Mario Ballano <mballano@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMUDORE_ROM_H
+#define EMUDORE_ROM_H
+
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief ROM image shared by every C64 in the process
+ *
+ * 64 kB page-aligned and read-only, BASIC, character generator and
+ * KERNAL sit at their CPU addresses so Memory can index it with the
+ * full address, the rest of the image is never accessed.
+ *
+ * If ./assets/roms/c64-roms.bin exists (the three ROMs concatenated,
+ * BASIC, characters and KERNAL, 20 kB) it is mmap'd on platforms that
+ * support it, otherwise each ROM is loaded once into a static buffer.
+ */
+class Rom
+{
+  private:
+    const uint8_t *data_;
+    bool mapped_;
+    uint64_t hash_;
+    Rom();
+    ~Rom();
+    Rom(const Rom&) = delete;
+    Rom &operator=(const Rom&) = delete;
+    bool map(const std::string &path);
+    static void load(uint8_t *image, const std::string &f, uint16_t baseaddr);
+  public:
+    static const Rom &shared();
+    const uint8_t *data() const {return data_;};
+    bool mapped() const {return mapped_;};
+    uint64_t hash() const {return hash_;};
+    /* constants */
+    static const size_t kImageSize = 0x10000;
+    static const size_t kSetSize = 0x5000;
+    static const char *kSetFile;
+};
+
+#endif
@@ -0,0 +1,243 @@
+/*
+ * emudore, Commodore 64 emulator
+ * Copyright (c) 2016, Mario Ballano <mballano@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <thread>
+#include <algorithm>
+#include "runner.h"
+#include "loader.h"
+#include "player.h"
+#include "bootcache.h"
+
+/**
+ * @brief a job in flight
+ */
+struct Runner::Machine
+{
+  size_t index;
+  C64 *c64;
+  Loader *loader;
+  Player *player;
+  unsigned int frames;
+  bool stopped;
+};
+
+/**
+ * @brief creates a runner with the given number of worker threads
+ *
+ * Zero means one per hardware thread.
+ */
+Runner::Runner(unsigned int threads)
+{
+  threads_ = threads;
+  if(threads_ == 0)
+    threads_ = std::max(1u,std::thread::hardware_concurrency());
+  next_job_ = 0;
+  pending_ = 0;
+  warm_boot_ = false;
+  frame_skip_ = false;
+}
+
+Runner::~Runner()
+{
+}
+
+/**
+ * @brief queues a machine, returns the index of its result
+ */
+size_t Runner::add(const Job &job)
+{
+  jobs_.push_back(job);
+  return jobs_.size() - 1;
+}
+
+/**
+ * @brief runs every queued job to completion
+ */
+std::vector<Runner::Result> Runner::run()
+{
+  results_.assign(jobs_.size(),Result());
+  next_job_ = 0;
+  pending_ = jobs_.size();
+  if(warm_boot_)
+    boot();
+  for(unsigned int i=0 ; i < threads_ ; i++)
+    workers_.push_back(new Worker());
+  std::vector<std::thread> threads;
+  for(unsigned int i=0 ; i < threads_ ; i++)
+    threads.push_back(std::thread(&Runner::work,this,i));
+  for(std::thread &t : threads)
+    t.join();
+  for(Worker *w : workers_)
+    delete w;
+  workers_.clear();
+  jobs_.clear();
+  return std::move(results_);
+}
+
+/**
+ * @brief leaves a post-boot snapshot in the BootCache
+ *
+ * Otherwise every machine started before the first one got to BASIC
+ * would go through the cold start as well.
+ */
+void Runner::boot()
+{
+  C64 c64;
+  if(BootCache::restore(&c64))
+    return;
+  /* a loader without a program stores the snapshot and stops */
+  Loader loader(&c64);
+  loader.warm_boot();
+  c64.callback([&loader](){ return loader.emulate(); });
+  c64.start();
+}
+
+/**
+ * @brief worker thread main loop
+ */
+void Runner::work(size_t id)
+{
+  while(pending_ > 0)
+  {
+    start(id);
+    Machine *m = pop(id);
+    if(m == nullptr)
+    {
+      /* every live machine is on a worker of its own, none to help */
+      if(next_job_ >= jobs_.size())
+        break;
+      std::this_thread::yield();
+      continue;
+    }
+    if(quantum(m))
+    {
+      std::lock_guard<std::mutex> l(workers_[id]->lock);
+      workers_[id]->queue.push_back(m);
+    }
+    else
+    {
+      finish(m);
+      pending_--;
+    }
+  }
+}
+
+/**
+ * @brief takes the next job if the worker has room, false if it didn't
+ */
+bool Runner::start(size_t id)
+{
+  Worker *w = workers_[id];
+  {
+    std::lock_guard<std::mutex> l(w->lock);
+    if(w->queue.size() >= kLiveMachines)
+      return false;
+  }
+  size_t i = next_job_++;
+  if(i >= jobs_.size())
+    return false;
+  Machine *m = new Machine();
+  m->index = i;
+  m->c64 = nullptr;
+  m->loader = nullptr;
+  m->player = nullptr;
+  m->frames = 0;
+  m->stopped = false;
+  std::lock_guard<std::mutex> l(w->lock);
+  w->queue.push_back(m);
+  return true;
+}
+
+/**
+ * @brief next machine to run, from our own queue or stolen
+ */
+Runner::Machine *Runner::pop(size_t id)
+{
+  for(size_t i=0 ; i < workers_.size() ; i++)
+  {
+    Worker *w = workers_[(id + i) % workers_.size()];
+    std::lock_guard<std::mutex> l(w->lock);
+    if(!w->queue.empty())
+    {
+      Machine *m = w->queue.front();
+      w->queue.pop_front();
+      return m;
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * @brief runs a machine for a frame, false once it is done
+ */
+bool Runner::quantum(Machine *m)
+{
+  const Job &job = jobs_[m->index];
+  if(m->c64 == nullptr)
+  {
+    m->c64 = new C64();
+    if(!job.program.empty())
+    {
+      Loader *loader = new Loader(m->c64);
+      loader->load(job.program);
+      if(warm_boot_)
+        loader->warm_boot();
+      m->c64->callback([loader](){ loader->emulate(); return true; });
+      m->loader = loader;
+    }
+    if(!job.replay.empty())
+    {
+      m->player = new Player(m->c64);
+      if(!m->player->open(job.replay))
+      {
+        m->stopped = true;
+        return false;
+      }
+    }
+  }
+  /* nothing to run, the results are those of the machine as set up */
+  if(job.frames == 0)
+    return false;
+  if(frame_skip_)
+  {
+    bool last = m->frames + 1 >= job.frames;
+    m->c64->vic()->frame_skip(last ? 0 : 1,1);
+  }
+  if(!m->c64->run_frame())
+  {
+    m->stopped = true;
+    return false;
+  }
+  return ++m->frames < job.frames;
+}
+
+/**
+ * @brief collects the results of a machine and destroys it
+ */
+void Runner::finish(Machine *m)
+{
+  Result &r = results_[m->index];
+  r.frames = m->frames;
+  r.cycles = m->c64->cpu()->cycles();
+  r.stopped = m->stopped;
+  if(collector_)
+    collector_(m->index,m->c64);
+  delete m->loader;
+  delete m->player;
+  delete m->c64;
+  delete m;
+}
@@ -0,0 +1,103 @@
+/*
+ * emudore, Commodore 64 emulator
+ * Copyright (c) 2016, Mario Ballano <mballano@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMUDORE_RUNNER_H
+#define EMUDORE_RUNNER_H
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "c64.h"
+
+/**
+ * @brief runs many independent machines on a thread pool
+ *
+ * Jobs wait in a shared list, each worker keeps up to kLiveMachines of
+ * them going and only starts the next one once one finishes, so 
+ * memory stays bounded by the number of threads rather than jobs. 
+ * Every job gets its own headless C64 (and Loader if it names a 
+ * program). Machines are run one frame at a time, after each frame 
+ * the machine goes back to the tail of its worker's queue, once no 
+ * jobs are left idle workers steal live machines from the head of the
+ * other queues, and leave when there are none.
+ *
+ * With warm_boot() machines skip the KERNAL cold start (see 
+ * Loader::warm_boot()), run() boots a machine first so the snapshot
+ * is there before any job starts. Jobs naming a replay play a 
+ * Recorder file instead, from its first keyframe. With frame_skip() 
+ * machines only rasterize their last frame.
+ *
+ * Results are collected per job and returned by run() once every 
+ * machine is done, collect() lets callers extract anything else 
+ * (screen, RAM, etc.) before a machine is destroyed. Zero-frame jobs
+ * are set up and collected without running.
+ */
+class Runner
+{
+  public:
+    struct Job
+    {
+      std::string program;
+      unsigned int frames;
+      std::string replay;
+    };
+    struct Result
+    {
+      unsigned int frames;
+      unsigned int cycles;
+      bool stopped;
+    };
+    typedef std::function<void(size_t,C64*)> Collector;
+  private:
+    struct Machine;
+    struct Worker
+    {
+      std::mutex lock;
+      std::deque<Machine*> queue;
+    };
+    std::vector<Job> jobs_;
+    std::vector<Result> results_;
+    std::vector<Worker*> workers_;
+    std::atomic<size_t> next_job_;
+    std::atomic<size_t> pending_;
+    Collector collector_;
+    unsigned int threads_;
+    bool warm_boot_;
+    bool frame_skip_;
+    void boot();
+    void work(size_t id);
+    bool start(size_t id);
+    Machine *pop(size_t id);
+    bool quantum(Machine *m);
+    void finish(Machine *m);
+  public:
+    Runner(unsigned int threads = 0);
+    ~Runner();
+    size_t add(const Job &job);
+    void collect(Collector c){collector_ = c;};
+    void warm_boot(bool v){warm_boot_ = v;};
+    void frame_skip(bool v){frame_skip_ = v;};
+    std::vector<Result> run();
+    /* constants */
+    static const size_t kLiveMachines = 2;
+};
+
+#endif
@@ -0,0 +1,106 @@
+/*
+ * emudore, Commodore 64 emulator
+ * Copyright (c) 2016, Mario Ballano <mballano@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "runner.h"
+#include "bootcache.h"
+
+/**
+ * @brief headless batch runner
+ *
+ * Runs every program given on the command line on its own C64, 
+ * spread over all the host cores, and prints per program how many
+ * frames and cycles it ran and a hash of its RAM.
+ *
+ *  emudore-runner [-j threads] [-f frames] [-w] [-c dir] [-s]
+ *                 [-p recording]... program...
+ *
+ * -w skips the KERNAL cold start restoring a post-boot snapshot, 
+ * -c keeps the snapshot in dir for later runs, -s only rasterizes 
+ * the last frame, -p replays an input recording (see Recorder) from
+ * its start.
+ */
+
+static void usage()
+{
+  fprintf(stderr,"usage: emudore-runner [-j threads] [-f frames] [-w] [-c dir] "
+                 "[-s] [-p recording]... program...\n");
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  unsigned int threads = 0;
+  unsigned int frames = 500;
+  bool warm_boot = false;
+  bool frame_skip = false;
+  std::vector<std::string> programs;
+  std::vector<std::string> replays;
+  for(int i=1 ; i < argc ; i++)
+  {
+    if(strcmp(argv[i],"-j") == 0 && i+1 < argc)
+      threads = atoi(argv[++i]);
+    else if(strcmp(argv[i],"-f") == 0 && i+1 < argc)
+      frames = atoi(argv[++i]);
+    else if(strcmp(argv[i],"-w") == 0)
+      warm_boot = true;
+    else if(strcmp(argv[i],"-c") == 0 && i+1 < argc)
+      BootCache::directory(argv[++i]);
+    else if(strcmp(argv[i],"-s") == 0)
+      frame_skip = true;
+    else if(strcmp(argv[i],"-p") == 0 && i+1 < argc)
+      replays.push_back(argv[++i]);
+    else if(argv[i][0] == '-')
+      usage();
+    else
+      programs.push_back(argv[i]);
+  }
+  if(programs.empty() && replays.empty())
+    usage();
+  Runner runner(threads);
+  runner.warm_boot(warm_boot);
+  runner.frame_skip(frame_skip);
+  for(std::string &p : programs)
+    runner.add({p,frames,""});
+  for(std::string &r : replays)
+    runner.add({"",frames,r});
+  programs.insert(programs.end(),replays.begin(),replays.end());
+  /* FNV-1a of the RAM, collected before each machine goes away */
+  std::vector<uint32_t> hashes(programs.size());
+  runner.collect([&hashes](size_t i, C64 *c64){
+    uint32_t h = 2166136261u;
+    for(unsigned int a=0 ; a < Memory::kMemSize ; a++)
+    {
+      h ^= c64->memory()->read_byte_no_io(a);
+      h *= 16777619u;
+    }
+    hashes[i] = h;
+  });
+  std::vector<Runner::Result> results = runner.run();
+  for(size_t i=0 ; i < results.size() ; i++)
+  {
+    printf("%s frames=%u cycles=%u ramhash=%08x%s\n",
+        programs[i].c_str(),results[i].frames,results[i].cycles,hashes[i],
+        results[i].stopped ? " stopped" : "");
+  }
+  return 0;
+}
@@ -0,0 +1,385 @@
+/*
+ * emudore, Commodore 64 emulator
+ * Copyright (c) 2016, Mario Ballano <mballano@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include "sdlsink.h"
+#include "vic.h"
+
+/* run() binds it to a reference, needs a definition without -O */
+const int SdlSink::kPollInterval;
+
+// clas ctor and dtor //////////////////////////////////////////////////////////
+
+SdlSink::SdlSink() :
+  render_(-1), quit_(false), running_(false), rewind_(nullptr)
+{
+  SDL_Init(SDL_INIT_VIDEO);
+  /**
+   * We create the window double the original pixel size, 
+   * the renderer takes care of upscaling 
+   */
+  window_ = SDL_CreateWindow(
+        "emudore",
+        SDL_WINDOWPOS_UNDEFINED,
+        SDL_WINDOWPOS_UNDEFINED,
+        Vic::kVisibleScreenWidth * 2,
+        Vic::kVisibleScreenHeight * 2,
+        SDL_WINDOW_OPENGL
+  );
+  /* use a single texture and hardware acceleration */
+  renderer_ = SDL_CreateRenderer(window_, -1, SDL_RENDERER_ACCELERATED);
+  texture_  = SDL_CreateTexture(renderer_,
+                                SDL_PIXELFORMAT_ARGB8888,
+                                SDL_TEXTUREACCESS_STREAMING,
+                                Vic::kVisibleScreenWidth,
+                                Vic::kVisibleScreenHeight);
+  for(int i=0 ; i < kBuffers ; i++)
+  {
+    buffers_[i].resize(Vic::kVisibleScreenWidth * Vic::kVisibleScreenHeight);
+    free_.push(i);
+  }
+  init_keyboard();
+}
+
+SdlSink::~SdlSink()
+{
+  SDL_DestroyTexture(texture_);
+  SDL_DestroyRenderer(renderer_);
+  SDL_DestroyWindow(window_);
+  SDL_Quit();
+}
+
+/**
+ * @brief init host key to C64 keyboard matrix map
+ */
+void SdlSink::init_keyboard()
+{
+  /* keymap letters */
+  keymap_[SDL_SCANCODE_A] = std::make_pair(1,2);
+  keymap_[SDL_SCANCODE_B] = std::make_pair(3,4);
+  keymap_[SDL_SCANCODE_C] = std::make_pair(2,4);
+  keymap_[SDL_SCANCODE_D] = std::make_pair(2,2);
+  keymap_[SDL_SCANCODE_E] = std::make_pair(1,6);
+  keymap_[SDL_SCANCODE_F] = std::make_pair(2,5);
+  keymap_[SDL_SCANCODE_G] = std::make_pair(3,2);
+  keymap_[SDL_SCANCODE_H] = std::make_pair(3,5);
+  keymap_[SDL_SCANCODE_I] = std::make_pair(4,1);
+  keymap_[SDL_SCANCODE_J] = std::make_pair(4,2);
+  keymap_[SDL_SCANCODE_K] = std::make_pair(4,5);
+  keymap_[SDL_SCANCODE_L] = std::make_pair(5,2);
+  keymap_[SDL_SCANCODE_M] = std::make_pair(4,4);
+  keymap_[SDL_SCANCODE_N] = std::make_pair(4,7);
+  keymap_[SDL_SCANCODE_O] = std::make_pair(4,6);
+  keymap_[SDL_SCANCODE_P] = std::make_pair(5,1);
+  keymap_[SDL_SCANCODE_Q] = std::make_pair(7,6);
+  keymap_[SDL_SCANCODE_R] = std::make_pair(2,1);
+  keymap_[SDL_SCANCODE_S] = std::make_pair(1,5);
+  keymap_[SDL_SCANCODE_T] = std::make_pair(2,6);
+  keymap_[SDL_SCANCODE_U] = std::make_pair(3,6);
+  keymap_[SDL_SCANCODE_V] = std::make_pair(3,7);
+  keymap_[SDL_SCANCODE_W] = std::make_pair(1,1);
+  keymap_[SDL_SCANCODE_X] = std::make_pair(2,7);
+  keymap_[SDL_SCANCODE_Y] = std::make_pair(3,1);
+  keymap_[SDL_SCANCODE_Z] = std::make_pair(1,4);
+  /* keymap numbers */
+  keymap_[SDL_SCANCODE_1] = std::make_pair(7,0);
+  keymap_[SDL_SCANCODE_2] = std::make_pair(7,3);
+  keymap_[SDL_SCANCODE_3] = std::make_pair(1,0);
+  keymap_[SDL_SCANCODE_4] = std::make_pair(1,3);
+  keymap_[SDL_SCANCODE_5] = std::make_pair(2,0);
+  keymap_[SDL_SCANCODE_6] = std::make_pair(2,3);
+  keymap_[SDL_SCANCODE_7] = std::make_pair(3,0);
+  keymap_[SDL_SCANCODE_8] = std::make_pair(3,3);
+  keymap_[SDL_SCANCODE_9] = std::make_pair(4,0);
+  keymap_[SDL_SCANCODE_0] = std::make_pair(4,3);
+  /* keymap function keys */
+  keymap_[SDL_SCANCODE_F1] = std::make_pair(0,4);
+  keymap_[SDL_SCANCODE_F3] = std::make_pair(0,4);
+  keymap_[SDL_SCANCODE_F5] = std::make_pair(0,4);
+  keymap_[SDL_SCANCODE_F7] = std::make_pair(0,4);
+  /* keymap: other */
+  keymap_[SDL_SCANCODE_RETURN]    = std::make_pair(0,1);
+  keymap_[SDL_SCANCODE_SPACE]     = std::make_pair(7,4);
+  keymap_[SDL_SCANCODE_LSHIFT]    = std::make_pair(1,7);
+  keymap_[SDL_SCANCODE_RSHIFT]    = std::make_pair(6,4);
+  keymap_[SDL_SCANCODE_COMMA]     = std::make_pair(5,7);
+  keymap_[SDL_SCANCODE_PERIOD]    = std::make_pair(5,4);
+  keymap_[SDL_SCANCODE_SLASH]     = std::make_pair(6,7);
+  keymap_[SDL_SCANCODE_SEMICOLON] = std::make_pair(6,2);
+  keymap_[SDL_SCANCODE_EQUALS]    = std::make_pair(6,5);
+  keymap_[SDL_SCANCODE_BACKSPACE] = std::make_pair(0,0);
+  keymap_[SDL_SCANCODE_MINUS]     = std::make_pair(5,3);
+  /* keymap: these are mapped to other keys */
+  keymap_[SDL_SCANCODE_BACKSLASH]    = std::make_pair(5,5); // : 
+  keymap_[SDL_SCANCODE_LEFTBRACKET]  = std::make_pair(5,0); // +
+  keymap_[SDL_SCANCODE_RIGHTBRACKET] = std::make_pair(6,1); // *
+  keymap_[SDL_SCANCODE_APOSTROPHE]   = std::make_pair(5,6); // @
+  keymap_[SDL_SCANCODE_LGUI]         = std::make_pair(7,5); // commodore key
+}
+
+// screen handling /////////////////////////////////////////////////////////////
+
+/**
+ * @brief runs emulate() on a thread of its own until it returns
+ *
+ * The calling thread, which must be the one that created the sink, 
+ * displays frames and polls host events in the meantime.
+ */
+void SdlSink::run(std::function<void()> emulate)
+{
+  running_ = true;
+  std::thread emulation([this,emulate](){
+    emulate();
+    running_ = false;
+    wake();
+  });
+  while(running_)
+  {
+    if(!show_frame())
+    {
+      /* nothing to show, poll events now and then */
+      std::unique_lock<std::mutex> l(wake_lock_);
+      wake_.wait_for(l,std::chrono::milliseconds(kPollInterval),
+          [this]{return !running_ || !frames_.empty();});
+    }
+    process_events();
+  }
+  emulation.join();
+  show_frame();
+}
+
+/**
+ * @brief wakes up run() waiting for a frame
+ */
+void SdlSink::wake()
+{
+  {
+    /* so the wakeup can't slip in between the check and the wait */
+    std::lock_guard<std::mutex> l(wake_lock_);
+  }
+  wake_.notify_one();
+}
+
+/**
+ * @brief refresh screen 
+ *
+ * Called on the emulation thread, queues the frame for display and
+ * applies the host input received since the last frame. If every 
+ * buffer is in use the frame is dropped and IO renders the next one
+ * into the same buffer.
+ */
+bool SdlSink::refresh(IO *io, const uint8_t *frame, size_t cols, size_t rows)
+{
+#if defined(EMSCRIPTEN)
+  /* skipped frames leave the last one on screen */
+  if(frame)
+    present(io->palette(),frame,cols,rows);
+  process_events();
+#else
+  int b;
+  if(frame && render_ >= 0 && frame == buffers_[render_].data() && 
+     free_.pop(&b))
+  {
+    Frame f;
+    f.buffer = render_;
+    std::copy(io->palette(),io->palette() + 16,f.palette);
+    f.cols = cols;
+    f.rows = rows;
+    frames_.push(f);
+    render_ = b;
+    wake();
+  }
+#endif
+  apply_input(io);
+  /* run at the C64 refresh rate (or whatever speed is set) */
+  governor_.pace();
+  return !quit_;
+}
+
+/**
+ * @brief buffer for IO to render the next frame into
+ *
+ * Buffers cycle between IO, the frame queue and the free queue, so 
+ * frames are never copied. Emscripten builds present from refresh()
+ * and leave IO its own buffer.
+ */
+uint8_t *SdlSink::frame_buffer(size_t cols, size_t rows)
+{
+#if defined(EMSCRIPTEN)
+  return nullptr;
+#else
+  if(cols * rows > buffers_[0].size())
+    return nullptr;
+  if(render_ < 0 && !free_.pop(&render_))
+    return nullptr;
+  return buffers_[render_].data();
+#endif
+}
+
+/**
+ * @brief shows the newest queued frame, false if there is none
+ *
+ * Frames queued while the previous one was being presented are 
+ * dropped.
+ */
+bool SdlSink::show_frame()
+{
+  Frame f, next;
+  if(!frames_.pop(&f))
+    return false;
+  while(frames_.pop(&next))
+  {
+    free_.push(f.buffer);
+    f = next;
+  }
+  present(f.palette,buffers_[f.buffer].data(),f.cols,f.rows);
+  free_.push(f.buffer);
+  return true;
+}
+
+/**
+ * @brief shows a frame
+ *
+ * The frame is converted to ARGB (SDL2 renderers don't take 
+ * palettized textures) straight into the locked streaming texture.
+ */
+void SdlSink::present(const unsigned int *palette, const uint8_t *frame,
+    size_t cols, size_t rows)
+{
+  if(upload(palette,frame,cols,rows))
+  {
+    SDL_RenderClear(renderer_);
+    SDL_RenderCopy(renderer_,texture_, NULL, NULL);
+    SDL_RenderPresent(renderer_);
+  }
+}
+
+/**
+ * @brief converts the frame into the texture, false if it can't be locked
+ */
+bool SdlSink::upload(const unsigned int *palette, const uint8_t *frame,
+    size_t cols, size_t rows)
+{
+  void *pixels;
+  int pitch;
+  if(SDL_LockTexture(texture_,NULL,&pixels,&pitch) != 0)
+    return false;
+  if((size_t)pitch == cols * sizeof(uint32_t))
+    IO::argb(palette,frame,(uint32_t *)pixels,cols * rows);
+  else
+  {
+    /* rows are padded */
+    for(size_t y=0 ; y < rows ; y++)
+    {
+      uint32_t *dst = (uint32_t *)((uint8_t *)pixels + y * pitch);
+      IO::argb(palette,frame + y * cols,dst,cols);
+    }
+  }
+  SDL_UnlockTexture(texture_);
+  return true;
+}
+
+/**
+ * @brief polls host events, keys are queued for apply_input()
+ */
+void SdlSink::process_events()
+{
+  SDL_Event event;
+  while(SDL_PollEvent(&event))
+  {
+    switch(event.type)
+    {
+    case SDL_KEYDOWN:
+    case SDL_KEYUP:
+      if(event.type == SDL_KEYDOWN)
+      {
+        speed_keys(event.key.keysym.scancode);
+        if(event.key.keysym.scancode == SDL_SCANCODE_F9)
+        {
+          Input i;
+          i.kind = kRewind;
+          input_.push(i);
+        }
+      }
+      if(keymap_.count(event.key.keysym.scancode))
+      {
+        Input i;
+        i.kind = event.type == SDL_KEYDOWN ? kKeyDown : kKeyUp;
+        i.key = keymap_[event.key.keysym.scancode];
+        input_.push(i);
+      }
+      break;
+    case SDL_QUIT:
+      quit_ = true;
+      break;
+    }
+  }
+}
+
+/**
+ * @brief forwards queued host keyboard events to IO
+ *
+ * Rewinding is deferred to the end of the frame, see Rewind::request().
+ */
+void SdlSink::apply_input(IO *io)
+{
+  Input i;
+  while(input_.pop(&i))
+  {
+    switch(i.kind)
+    {
+    case kKeyDown:
+      io->handle_keydown(i.key);
+      break;
+    case kKeyUp:
+      io->handle_keyup(i.key);
+      break;
+    case kRewind:
+      if(rewind_)
+        rewind_->request(kRewindStep);
+      break;
+    }
+  }
+}
+
+/**
+ * @brief speed control hotkeys
+ */
+void SdlSink::speed_keys(SDL_Scancode k)
+{
+  unsigned int speed = governor_.speed();
+  switch(k)
+  {
+  case SDL_SCANCODE_F12:
+    governor_.warp(!governor_.warp());
+    break;
+  case SDL_SCANCODE_PAGEUP:
+    governor_.speed(speed + kSpeedStep);
+    break;
+  case SDL_SCANCODE_PAGEDOWN:
+    if(speed > kSpeedStep)
+      governor_.speed(speed - kSpeedStep);
+    break;
+  case SDL_SCANCODE_HOME:
+    governor_.speed(Governor::kRealTime);
+    governor_.warp(false);
+    break;
+  default:
+    break;
+  }
+}
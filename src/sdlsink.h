@@ -0,0 +1,126 @@
+/*
+ * emudore, Commodore 64 emulator
+ * Copyright (c) 2016, Mario Ballano <mballano@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMUDORE_SDLSINK_H
+#define EMUDORE_SDLSINK_H
+
+#include <SDL.h>
+#include <unordered_map>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "io.h"
+#include "governor.h"
+#include "spscqueue.h"
+#include "rewind.h"
+
+/**
+ * @brief SDL2 frontend
+ *
+ * Displays frames in a window, maps the host keyboard onto the C64 
+ * keyboard matrix and paces emulation through a Governor.
+ *
+ * run() moves emulation to a thread of its own while the calling 
+ * (main) thread keeps the window, renderer and event loop, SDL only
+ * supports those on the thread that created the window. IO renders 
+ * straight into one of kBuffers buffers (see frame_buffer()) which 
+ * refresh(), on the emulation thread, hands over through a lock-free
+ * queue, free buffers come back through another. The display shows 
+ * the newest frame queued and if no buffer is free the frame is 
+ * dropped, emulation never waits for it. Host input goes the other 
+ * way through a third queue and is applied by refresh(). Emscripten
+ * builds have no threads, they call refresh() from the browser's 
+ * main loop which presents and polls events itself.
+ *
+ * Host keys not mapped to the C64: F12 toggles warp, Page Up/Down 
+ * change the speed by kSpeedStep percent and Home goes back to real
+ * time. F9 steps back kRewindStep frames if a Rewind buffer is set.
+ */
+class SdlSink : public Sink
+{
+  private:
+    SDL_Window *window_;
+    SDL_Renderer *renderer_;
+    SDL_Texture *texture_;
+    /* frames, emulation thread to display */
+    static const int kBuffers = 3;
+    struct Frame
+    {
+      int buffer;
+      /* the C64 may be gone by the time the frame is shown */
+      unsigned int palette[16];
+      size_t cols;
+      size_t rows;
+    };
+    std::vector<uint8_t> buffers_[kBuffers];
+    /* being rendered into by IO, -1 until frame_buffer() is called */
+    int render_;
+    SpscQueue<Frame,kBuffers> frames_;
+    SpscQueue<int,kBuffers> free_;
+    std::mutex wake_lock_;
+    std::condition_variable wake_;
+    void wake();
+    bool show_frame();
+    void present(const unsigned int *palette, const uint8_t *frame,
+        size_t cols, size_t rows);
+    bool upload(const unsigned int *palette, const uint8_t *frame,
+        size_t cols, size_t rows);
+    /* host input, display to emulation thread */
+    enum kInput
+    {
+      kKeyDown,
+      kKeyUp,
+      kRewind,
+    };
+    struct Input
+    {
+      kInput kind;
+      IO::Key key;
+    };
+    static const size_t kInputEvents = 64;
+    SpscQueue<Input,kInputEvents> input_;
+    std::atomic<bool> quit_;
+    std::atomic<bool> running_;
+    Rewind *rewind_;
+    /* keyboard mappings */
+    std::unordered_map<SDL_Keycode,IO::Key> keymap_;
+    /* speed */
+    Governor governor_;
+    void process_events();
+    void apply_input(IO *io);
+    void speed_keys(SDL_Scancode k);
+    void init_keyboard();
+  public:
+    SdlSink();
+    ~SdlSink();
+    void run(std::function<void()> emulate);
+    bool refresh(IO *io, const uint8_t *frame, size_t cols, size_t rows);
+    uint8_t *frame_buffer(size_t cols, size_t rows);
+    bool lagging(){return governor_.lagging();};
+    Governor * governor(){return &governor_;};
+    void rewind(Rewind *r){rewind_ = r;};
+    /* constants */
+    static const unsigned int kSpeedStep = 25;
+    static const size_t kRewindStep = 50; /* a second at 50 Hz */
+    static const int kPollInterval = 5;
+};
+
+#endif
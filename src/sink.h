@@ -0,0 +1,74 @@
+/*
+ * emudore, Commodore 64 emulator
+ * Copyright (c) 2016, Mario Ballano <mballano@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMUDORE_SINK_H
+#define EMUDORE_SINK_H
+
+#include <cstdint>
+#include <cstddef>
+
+class IO;
+
+/**
+ * @brief video output and host input of IO
+ *
+ * IO renders every frame into a buffer of palette indexes and hands
+ * it to the sink once complete, the sink displays it (or not, 
+ * IO::argb() converts it) and feeds host input back into IO (see 
+ * IO::handle_keydown()). The buffer is IO's own unless the sink 
+ * provides them through frame_buffer().
+ *
+ * SdlSink is the desktop frontend, NullSink runs headless.
+ */
+class Sink
+{
+  public:
+    virtual ~Sink(){};
+    /**
+     * @brief called once per frame, returning false quits the emulator
+     *
+     * frame is null if the VIC-II skipped rasterizing it (see 
+     * Vic::frame_skip()), the previous one is still current.
+     */
+    virtual bool refresh(IO *io, const uint8_t *frame,
+        size_t cols, size_t rows) = 0;
+    /**
+     * @brief whether the host is falling behind, see Vic::adaptive_skip()
+     */
+    virtual bool lagging(){return false;};
+    /**
+     * @brief buffer of cols * rows bytes to render the next frame into
+     *
+     * Asked for once at start and after every drawn frame, so a sink
+     * that keeps frames past refresh() can take them over instead of
+     * copying. It may return the buffer just refreshed again (that 
+     * frame was dropped), nullptr has IO render into its own buffer.
+     */
+    virtual uint8_t *frame_buffer(size_t cols, size_t rows){return nullptr;};
+};
+
+/**
+ * @brief headless sink, frames are dropped and there is no input
+ */
+class NullSink : public Sink
+{
+  public:
+    bool refresh(IO *io, const uint8_t *frame, size_t cols, size_t rows)
+      {return true;};
+};
+
+#endif
@@ -0,0 +1,75 @@
+/*
+ * emudore, Commodore 64 emulator
+ * Copyright (c) 2016, Mario Ballano <mballano@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMUDORE_SPSCQUEUE_H
+#define EMUDORE_SPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+
+/**
+ * @brief lock-free single producer single consumer queue
+ *
+ * A ring of N entries (one slot is kept empty to tell full from 
+ * empty), push() may only be called from one thread and pop() from 
+ * another. Neither blocks, they fail when the queue is full or empty.
+ */
+template<typename T, size_t N>
+class SpscQueue
+{
+  private:
+    static const size_t kSlots = N + 1;
+    static const size_t kCacheLine = 64;
+    T items_[kSlots];
+    /**
+     * each index is written by one side only, the padding keeps them
+     * off each other's cache line (alignas would need aligned new)
+     */
+    char pad0_[kCacheLine];
+    std::atomic<size_t> head_;
+    char pad1_[kCacheLine - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> tail_;
+    char pad2_[kCacheLine - sizeof(std::atomic<size_t>)];
+  public:
+    SpscQueue() : head_(0), tail_(0) {};
+    bool push(const T &v)
+    {
+      size_t t = tail_.load(std::memory_order_relaxed);
+      size_t next = (t + 1) % kSlots;
+      if(next == head_.load(std::memory_order_acquire))
+        return false;
+      items_[t] = v;
+      tail_.store(next,std::memory_order_release);
+      return true;
+    };
+    bool pop(T *v)
+    {
+      size_t h = head_.load(std::memory_order_relaxed);
+      if(h == tail_.load(std::memory_order_acquire))
+        return false;
+      *v = items_[h];
+      head_.store((h + 1) % kSlots,std::memory_order_release);
+      return true;
+    };
+    bool empty() const
+    {
+      return head_.load(std::memory_order_acquire) == 
+             tail_.load(std::memory_order_acquire);
+    };
+};
+
+#endif
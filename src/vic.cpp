@@ -15,8 +15,13 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#include <cstring>
 #include "vic.h"
 #include "util.h"
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 // ctor and emulate()  ///////////////////////////////////////////////////////
 
@@ -34,6 +39,10 @@ Vic::Vic()
   msbx_ = sprite_double_height_ = sprite_double_width_ = 0;
   sprite_enabled_ = sprite_priority_ = sprite_multicolor_ = 0;       
   sprite_shared_colors_[0] = sprite_shared_colors_[1] = 0;
+  for(SpriteRow &r : sprite_rows_)
+    r.key = 0;
+  sprite_lines_dirty_ = true;
+  sprite_collision_ = background_collision_ = 0;
   /* colors */
   border_color_ = 0;
   bgcolor_[0] = bgcolor_[1] = bgcolor_[2] = bgcolor_[3] = 0;
@@ -41,12 +50,16 @@ Vic::Vic()
   cr1_ = cr2_ = 0;
   /* frame counter */
   frame_c_ = 0;
+  /* frame skipping */
+  skip_ = skip_period_ = adaptive_skip_ = skipped_ = 0;
+  draw_ = true;
   /* default memory pointers */
   screen_mem_ = Memory::kBaseAddrScreen;
   char_mem_   = Memory::kBaseAddrChars;
   bitmap_mem_ = Memory::kBaseAddrBitmap;
   /* bit 0 is unused */
   mem_pointers_ = (1 << 0);
+  vm_row_ = -1;
   /* current graphic mode */
   graphic_mode_ = kCharMode;
 }
@@ -71,32 +84,61 @@ bool Vic::emulate()
     {
       /* set interrupt origin (raster) */
       irq_status_ |= (1<<0);
-      /* raise interrupt */
+      /* raise interrupt, the line is held until acknowledged */
+      cpu_->irq_line(true);
       cpu_->irq();
     }
+    if (rstr == kFirstVisibleLine)
+    {
+      draw_ = draw_frame();
+      vm_row_ = -1;
+    }
     if (rstr >= kFirstVisibleLine &&
         rstr < kLastVisibleLine)
     {
-      /* draw border */
-      int screen_y = rstr - kFirstVisibleLine;
-      io_->screen_draw_border(screen_y,border_color_);
-      /* draw raster on current graphic mode */
-      switch(graphic_mode_)
+      bool graphics = rstr >= kGFirstLine && rstr < kGLastLine &&
+        !is_screen_off();
+      /* checked whether drawn or not, skipping must not change timing */
+      if (graphics &&
+          (graphic_mode_ == kExtBgMode || graphic_mode_ == kIllegalMode))
       {
-      case kCharMode:
-      case kMCCharMode:
-        draw_raster_char_mode();
-        break;
-      case kBitmapMode:
-      case kMCBitmapMode:
-        draw_raster_bitmap_mode();
-        break;
-      default:
         D("unsupported graphic mode: %d\n",graphic_mode_);
         return false;
       }
-      /* draw sprites */
-      draw_raster_sprites();
+      if (draw_)
+      {
+        /* the line is composed in palette indexes, layer over layer */
+        uint8_t *line = io_->screen_row(rstr - kFirstVisibleLine);
+        uint8_t border = border_color_ & 0xf;
+        if(graphics)
+        {
+          /* draw border around the graphics window */
+          std::fill_n(line,kGFirstCol,border);
+          std::fill(line + kGFirstCol + kGResX,line + kVisibleScreenWidth,border);
+          /* draw raster on current graphic mode */
+          switch(graphic_mode_)
+          {
+          case kCharMode:
+          case kMCCharMode:
+            draw_raster_char_mode(line);
+            break;
+          case kBitmapMode:
+          case kMCBitmapMode:
+            draw_raster_bitmap_mode(line);
+            break;
+          default:
+            break;
+          }
+        }
+        else
+          std::fill_n(line,kVisibleScreenWidth,border);
+        raster_sprites(line);
+      }
+      else
+      {
+        /* sprite collisions are detected on skipped frames too */
+        raster_sprites(nullptr);
+      }
     }
     /* next raster */
     if(is_bad_line())
@@ -107,7 +149,7 @@ bool Vic::emulate()
     raster_counter(++rstr);
     if (rstr >= kScreenLines)
     {
-      io_->screen_refresh();
+      io_->screen_refresh(draw_);
       frame_c_++;
       raster_counter(0);
     }
@@ -115,6 +157,33 @@ bool Vic::emulate()
   return true;
 }
 
+/**
+ * @brief whether the frame being started is rasterized
+ *
+ * Decided on its first visible line, so settings changed between 
+ * frames (e.g. by Runner) apply to the next one. skip_ out of every 
+ * skip_period_ frames are skipped, and while the sink lags up to 
+ * adaptive_skip_ more in a row.
+ */
+bool Vic::draw_frame()
+{
+  bool draw = true;
+  if(skip_period_ && frame_c_ % skip_period_ < skip_)
+    draw = false;
+  else if(skipped_ < adaptive_skip_ && io_->lagging())
+    draw = false;
+  skipped_ = draw ? 0 : skipped_ + 1;
+  return draw;
+}
+
+/**
+ * @brief cycles left until the next raster line
+ */
+int Vic::next_event()
+{
+  return next_raster_at_ - cpu_->cycles();
+}
+
 // DMA register access  //////////////////////////////////////////////////////
 
 uint8_t Vic::read_register(uint8_t r)
@@ -128,6 +197,7 @@ uint8_t Vic::read_register(uint8_t r)
   case 0x4:
   case 0x6:
   case 0x8:
+  case 0xa:
   case 0xc:
   case 0xe:
     retval = mx_[r >> 1];
@@ -199,6 +269,16 @@ uint8_t Vic::read_register(uint8_t r)
   case 0x1d:
     retval = sprite_double_width_;
     break;
+  /* sprite-sprite collisions, cleared on read */
+  case 0x1e:
+    retval = sprite_collision_;
+    sprite_collision_ = 0;
+    break;
+  /* sprite-background collisions, cleared on read */
+  case 0x1f:
+    retval = background_collision_;
+    background_collision_ = 0;
+    break;
   /* border color */
   case 0x20:
     retval = border_color_;
@@ -260,6 +340,7 @@ void Vic::write_register(uint8_t r, uint8_t v)
   case 0x4:
   case 0x6:
   case 0x8:
+  case 0xa:
   case 0xc:
   case 0xe:
     mx_[r >> 1] = v;
@@ -274,6 +355,7 @@ void Vic::write_register(uint8_t r, uint8_t v)
   case 0xd:
   case 0xf:
     my_[r >> 1] = v;
+    sprite_lines_dirty_ = true;
     break;
   /* MSBs of X coordinates */
   case 0x10:
@@ -293,6 +375,7 @@ void Vic::write_register(uint8_t r, uint8_t v)
   /* sprite enable register */
   case 0x15:
     sprite_enabled_ = v;
+    sprite_lines_dirty_ = true;
     break;
   /* control register 2 */
   case 0x16:
@@ -302,6 +385,7 @@ void Vic::write_register(uint8_t r, uint8_t v)
   /* sprite double height */
   case 0x17:
     sprite_double_height_ = v;
+    sprite_lines_dirty_ = true;
     break;
   /* memory pointers  */
   case 0x18:
@@ -318,6 +402,7 @@ void Vic::write_register(uint8_t r, uint8_t v)
   case 0x19:
     /* acknowledge interrupts by mask */
     irq_status_ &= ~(v&0xf);
+    cpu_->irq_line((irq_status_&0xf) != 0);
     break;
   /* interrupt enable register */
   case 0x1a:
@@ -410,21 +495,22 @@ void Vic::set_graphic_mode()
 }
 
 /**
- * @brief retrieves a character from screen Memory
- */
-uint8_t Vic::get_screen_char(int column, int row)
-{
-  uint16_t addr = screen_mem_ + (row * kGCols) + column;
-  return mem_->vic_read_byte(addr);
-}
-
-/**
- * @brief retrives color RAM for given screen coords
+ * @brief fills the line buffer with a row of screen codes and colors
+ *
+ * Like the real chip does on bad lines the video matrix and color RAM
+ * are read once per character row and reused for its 8 raster lines,
+ * only the character/bitmap data is fetched on every line.
  */
-uint8_t Vic::get_char_color(int column, int row)
+void Vic::fetch_video_matrix(int row)
 {
-  uint16_t addr = Memory::kAddrColorRAM + (row * kGCols) + column;
-  return (mem_->read_byte_no_io(addr) & 0x0f);
+  uint16_t addr = screen_mem_ + row * kGCols;
+  uint16_t color_addr = Memory::kAddrColorRAM + row * kGCols;
+  for(int column=0; column < kGCols ; column++)
+  {
+    vm_chars_[column] = mem_->vic_read_byte(addr + column);
+    vm_colors_[column] = mem_->read_byte_no_io(color_addr + column) & 0x0f;
+  }
+  vm_row_ = row;
 }
 
 /**
@@ -456,314 +542,601 @@ uint16_t Vic::get_sprite_ptr(int n)
   return kSpriteSize * mem_->vic_read_byte(ptraddr);
 }
  
-// raster drawing  ///////////////////////////////////////////////////////////
+// pixel kernels /////////////////////////////////////////////////////////////
 
-void Vic::draw_char(int x, int y, uint8_t data, uint8_t color)
+/**
+ * @brief byte to pixel expansion tables
+ *
+ * The color index of each of the 8 pixels a graphics byte turns 
+ * into, leftmost first: 0-1 in hires modes, 0-3 in multicolor modes
+ * where every bit pair covers two pixels.
+ *
+ * The masks have a bit per pixel, leftmost in bit 0, multicolor 
+ * masks select the pixels of one color index. Planes are the same 
+ * with a byte per pixel, 1 where the pixel has that color index, so 
+ * multiplying one by a color gives the 8 pixels in a 64 bit word.
+ */
+static const struct PixelTables
 {
-  for(int i=0 ; i < 8 ; i++)
+  uint8_t hires[256][8];
+  uint8_t multicolor[256][8];
+  uint64_t hires_planes[256][2];
+  uint64_t multicolor_planes[256][4];
+  uint8_t hires_mask[256];
+  uint8_t multicolor_mask[256][4];
+  /* masks with every pixel doubled, for double width sprites */
+  uint16_t wide[256];
+  PixelTables()
   {
-    int xoffs = x + 8 - i + horizontal_scroll();
-    /* don't draw outside (due to horizontal scroll) */
-    if(xoffs > kGFirstCol + kGResX)
-      continue;
-    /* draw pixel */
-    if(ISSET_BIT(data,i))
+    for(int b=0 ; b < 256 ; b++)
     {
-      io_->screen_update_pixel(
-        xoffs, 
-        y,
-        color);
+      hires_mask[b] = wide[b] = 0;
+      std::fill_n(multicolor_mask[b],4,0);
+      for(int i=0 ; i < 8 ; i++)
+      {
+        hires[b][i] = (b >> (7 - i)) & 1;
+        multicolor[b][i] = (b >> (6 - (i & 6))) & 3;
+        hires_mask[b] |= hires[b][i] << i;
+        multicolor_mask[b][multicolor[b][i]] |= 1 << i;
+        if(ISSET_BIT(b,i))
+          wide[b] |= 3 << (i * 2);
+      }
+      for(int c=0 ; c < 4 ; c++)
+      {
+        uint8_t hp[8], mp[8];
+        for(int i=0 ; i < 8 ; i++)
+        {
+          hp[i] = hires[b][i] == c;
+          mp[i] = multicolor[b][i] == c;
+        }
+        if(c < 2)
+          memcpy(&hires_planes[b][c],hp,8);
+        memcpy(&multicolor_planes[b][c],mp,8);
+      }
     }
   }
+} kPixels;
+
+/**
+ * @brief writes 8 pixels, the planes multiplied by their colors
+ *
+ * Pixel bytes never carry into each other as colors are below 16.
+ */
+static inline void put_pixels(uint8_t *dst, const uint64_t *planes, 
+    const uint8_t *colors, int n)
+{
+  uint64_t px = 0;
+  for(int c=0 ; c < n ; c++)
+    px += planes[c] * colors[c];
+  memcpy(dst,&px,8);
+}
+
+/**
+ * @brief writes color to the 8 pixels set in plane, the rest are kept
+ */
+static inline void put_fg_pixels(uint8_t *dst, uint64_t plane, uint8_t color)
+{
+  uint64_t px;
+  memcpy(&px,dst,8);
+  px = (px & ~(plane * 0xff)) | (plane * color);
+  memcpy(dst,&px,8);
+}
+
+/**
+ * @brief index of the lowest set bit, m must not be 0
+ */
+static inline int lowest_bit(uint64_t m)
+{
+#if defined(_MSC_VER)
+  unsigned long i;
+  _BitScanForward64(&i,m);
+  return (int)i;
+#else
+  return __builtin_ctzll(m);
+#endif
+}
+
+/**
+ * @brief writes color to the pixels set in a 64 pixel mask
+ */
+static inline void put_mask(uint8_t *dst, uint64_t m, uint8_t color)
+{
+  for( ; m != 0 ; m &= m - 1)
+    dst[lowest_bit(m)] = color;
+}
+
+// line masks ////////////////////////////////////////////////////////////////
+
+/**
+ * @brief the 64 pixels of a line mask starting at x
+ */
+static inline uint64_t mask_at(const uint64_t *line, int x)
+{
+  int w = x >> 6;
+  int s = x & 63;
+  uint64_t m = line[w] >> s;
+  if(s)
+    m |= line[w + 1] << (64 - s);
+  return m;
+}
+
+/**
+ * @brief sets the 64 pixels of a line mask starting at x
+ */
+static inline void set_mask_at(uint64_t *line, int x, uint64_t m)
+{
+  int w = x >> 6;
+  int s = x & 63;
+  line[w] |= m << s;
+  if(s)
+    line[w + 1] |= m >> (64 - s);
 }
 
-void Vic::draw_mcchar(int x, int y, uint8_t data, uint8_t color)
+/**
+ * @brief the pixels in [lo,hi) out of the 64 starting at x
+ */
+static inline uint64_t span(int x, int lo, int hi)
 {
-  for(int i=0 ; i < 4 ; i++)
+  lo = std::max(lo - x,0);
+  hi = std::min(hi - x,64);
+  if(lo >= hi)
+    return 0;
+  uint64_t m = (hi == 64) ? ~0ull : (1ull << hi) - 1;
+  return m & ~((1ull << lo) - 1);
+}
+
+/**
+ * @brief whether two 64 pixel masks starting at xa and xb overlap
+ */
+static inline bool overlap(uint64_t a, int xa, uint64_t b, int xb)
+{
+  if(xa > xb)
+    return overlap(b,xb,a,xa);
+  int d = xb - xa;
+  return d < 64 && ((a >> d) & b) != 0;
+}
+
+// raster drawing  ///////////////////////////////////////////////////////////
+
+/**
+ * @brief draws a hires character, 0 bits let the background through
+ *
+ * Hires pixels start one pixel right of x, which includes the 
+ * horizontal scroll.
+ */
+void Vic::draw_char(uint8_t *line, int x, uint8_t data, uint8_t color)
+{
+  if(x + 8 <= kGFirstCol + kGResX)
+    put_fg_pixels(line + x + 1,kPixels.hires_planes[data][1],color);
+  else
   {
-    /* color */
-    uint8_t c;
-    /* color source */
-    uint8_t cs = ((data >> i*2) & 0x3);
-    switch(cs)
+    /* don't draw outside (due to horizontal scroll) */
+    const uint8_t *idx = kPixels.hires[data];
+    for(int i=0 ; x + 1 + i <= kGFirstCol + kGResX ; i++)
     {
-    case 0:
-      c = bgcolor_[0]; 
-      break;
-    case 1:
-      c = bgcolor_[1];
-      break;
-    case 2:
-      c = bgcolor_[2];
-      break;
-    case 3:
-      c = color;
-      break;
+      if(idx[i])
+        line[x + 1 + i] = color;
     }
-    int xoffs = x + 8 - i * 2 + horizontal_scroll();
-    io_->screen_update_pixel(
-      xoffs,
-      y,
-      c);
-    io_->screen_update_pixel(
-      xoffs + 1,
-      y,
-      c);
   }
 }
 
-void Vic::draw_raster_char_mode()
+/**
+ * @brief draws a multicolor character or bitmap cell
+ *
+ * Multicolor pixels start two pixels right of x, colors holds the 
+ * four colors a bit pair selects.
+ */
+void Vic::draw_multicolor(uint8_t *line, int x, uint8_t data, const uint8_t *colors)
+{
+  put_pixels(line + x + 2,kPixels.multicolor_planes[data],colors,4);
+}
+
+void Vic::draw_raster_char_mode(uint8_t *line)
 {
   int rstr = raster_counter();
-  int y = rstr - kFirstVisibleLine;
-  if((rstr >= kGFirstLine) && 
-     (rstr < kGLastLine) && 
-     !is_screen_off())
+  int hscroll = horizontal_scroll();
+  int row = (rstr - kGFirstLine) / 8;
+  int char_row = (rstr - kGFirstLine) % 8;
+  if(row != vm_row_)
+    fetch_video_matrix(row);
+  uint8_t multicolor[4] = {
+    (uint8_t)(bgcolor_[0] & 0xf),
+    (uint8_t)(bgcolor_[1] & 0xf),
+    (uint8_t)(bgcolor_[2] & 0xf),
+    0};
+  /* draw background */
+  std::fill_n(line + kGFirstCol,kGResX,multicolor[0]);
+  /* draw characters */
+  for(int column=0; column < kGCols ; column++)
   {
-    /* draw background */
-    io_->screen_draw_rect(kGFirstCol,y,kGResX,bgcolor_[0]);
-    /* draw characters */
-    for(int column=0; column < kGCols ; column++)
+    /* check 38 cols mode */
+    if(!ISSET_BIT(cr2_,3))
     {
-      /* check 38 cols mode */
-      if(!ISSET_BIT(cr2_,3))
-      {
-        if (column == 0) continue; 
-        if (column == kGCols -1 ) continue; 
-      }
-      int x = kGFirstCol + column * 8;
-      int line = rstr - kGFirstLine;
-      int row = line/8;
-      int char_row = line % 8;
-      /* retrieve screen character */
-      uint8_t c = get_screen_char(column,row);
-      /* retrieve character bitmap data */
-      uint8_t data = get_char_data(c,char_row);
-      /* retrieve color data */
-      uint8_t color  = get_char_color(column,row);
-      /* draw character */
-      if(graphic_mode_ == kMCCharMode && ISSET_BIT(color,3))
-        draw_mcchar(x,y,data,(color&0x7));
-      else
-        draw_char(x,y,data,color);
+      if (column == 0) continue; 
+      if (column == kGCols -1 ) continue; 
     }
+    int x = kGFirstCol + column * 8 + hscroll;
+    /* retrieve character bitmap data */
+    uint8_t data = get_char_data(vm_chars_[column],char_row);
+    uint8_t color = vm_colors_[column];
+    /* draw character */
+    if(graphic_mode_ == kMCCharMode && ISSET_BIT(color,3))
+    {
+      multicolor[3] = color & 0x7;
+      draw_multicolor(line,x,data,multicolor);
+    }
+    else
+      draw_char(line,x,data,color);
   }
 }
 
-void Vic::draw_bitmap(int x, int y, uint8_t data, uint8_t color)
+/**
+ * @brief draws a hires bitmap cell, see draw_char()
+ *
+ * colors holds the background color at [0] and the foreground at [1].
+ */
+void Vic::draw_bitmap(uint8_t *line, int x, uint8_t data, const uint8_t *colors)
 {
-  uint8_t forec   = (color >> 4) & 0xf;
-  uint8_t bgc =  color & 0xf;
-  for(int i=0 ; i < 8 ; i++)
+  if(x + 8 <= kGFirstCol + kGResX)
+    put_pixels(line + x + 1,kPixels.hires_planes[data],colors,2);
+  else
   {
-    int xoffs = x + 8 - i + horizontal_scroll();
     /* don't draw outside (due to horizontal scroll) */
-    if(xoffs > kGFirstCol + kGResX)
-      continue;
-    /* draw pixel */
-    if(ISSET_BIT(data,i))
+    const uint8_t *idx = kPixels.hires[data];
+    for(int i=0 ; x + 1 + i <= kGFirstCol + kGResX ; i++)
+      line[x + 1 + i] = colors[idx[i]];
+  }
+}
+
+void Vic::draw_raster_bitmap_mode(uint8_t *line)
+{
+  int rstr = raster_counter();
+  int hscroll = horizontal_scroll();
+  int row = (rstr - kGFirstLine) / 8;
+  int bitmap_row = (rstr - kGFirstLine) % 8;
+  if(row != vm_row_)
+    fetch_video_matrix(row);
+  uint8_t colors[4] = {(uint8_t)(bgcolor_[0] & 0xf), 0, 0, 0};
+  /* draw background, cells are opaque so only left of the first one */
+  int first = graphic_mode_ == kBitmapMode ? 1 : 2;
+  std::fill_n(line + kGFirstCol,hscroll + first,colors[0]);
+  /* draw bitmaps */
+  for(int column=0; column < kGCols ; column++)
+  {
+    int x = kGFirstCol + column * 8 + hscroll;
+    /* retrieve bitmap data */
+    uint8_t data = get_bitmap_data(column,row,bitmap_row);
+    /* retrieve color data */
+    uint8_t scolor = vm_chars_[column];
+    /* draw bitmap */
+    if(graphic_mode_ == kBitmapMode)
     {
-      io_->screen_update_pixel(
-        xoffs, 
-        y,
-        forec);
+      colors[0] = scolor & 0xf;
+      colors[1] = scolor >> 4;
+      draw_bitmap(line,x,data,colors);
     }
     else
     {
-      io_->screen_update_pixel(
-        xoffs, 
-        y,
-        bgc);
+      colors[1] = scolor >> 4;
+      colors[2] = scolor & 0xf;
+      colors[3] = vm_colors_[column];
+      draw_multicolor(line,x,data,colors);
     }
   }
 }
 
-void Vic::draw_mcbitmap(int x, int y, uint8_t data, uint8_t scolor, uint8_t rcolor)
+// sprites ///////////////////////////////////////////////////////////////////
+
+/**
+ * @brief rebuilds the per-line sprite list
+ *
+ * For every raster line a mask of the sprites covering it, iterating
+ * its bits from 0 up visits them in priority order. Only positions,
+ * enable and double height bits change it so it is rebuilt lazily 
+ * after writes to those registers.
+ */
+void Vic::update_sprite_lines()
 {
-  for(int i=0 ; i < 4 ; i++)
+  std::fill_n(sprite_lines_,kScreenLines,0);
+  for(int n=0; n < 8 ; n++)
   {
-    /* color */
-    uint8_t c;
-    /* color source */
-    uint8_t cs = ((data >> i*2) & 0x3);
-    switch(cs)
-    {
-    case 0:
-      c = bgcolor_[0]; 
-      break;
-    case 1:
-      c = (scolor >> 4) & 0xf;
-      break;
-    case 2:
-      c = scolor & 0xf;
-      break;
-    case 3:
-      c = rcolor;
-      break;
-    }
-    int xoffs = x + 8 - i * 2 + horizontal_scroll();
-    io_->screen_update_pixel(
-      xoffs,
-      y,
-      c);
-    io_->screen_update_pixel(
-      xoffs + 1,
-      y,
-      c);
-  }  
+    if(!is_sprite_enabled(n))
+      continue;
+    int height = is_double_height_sprite(n) ? kSpriteHeight * 2 : kSpriteHeight;
+    int first = my_[n] + kSpritesFirstLine;
+    for(int rstr = first ; rstr < first + height && rstr < kScreenLines ; rstr++)
+      sprite_lines_[rstr] |= (1 << n);
+  }
+  sprite_lines_dirty_ = false;
 }
- 
-void Vic::draw_raster_bitmap_mode()
+
+/**
+ * @brief pixel masks of a sprite row
+ *
+ * mask[1..3] hold the pixels of each color source (hires sprites only
+ * use [2], the sprite color) and mask[0] all non-transparent ones, 
+ * leftmost pixel in bit 0 and doubled for double width sprites. 
+ *
+ * The last row expanded is kept per sprite along with the data it was 
+ * built from, rows repeat on double height sprites and on sprites 
+ * made of identical lines.
+ */
+const Vic::SpriteRow &Vic::sprite_row(int n, int row)
 {
-  int rstr = raster_counter();
-  int y = rstr - kFirstVisibleLine;
-  if((rstr >= kGFirstLine) && 
-     (rstr < kGLastLine) && 
-     !is_screen_off())
+  uint16_t addr = get_sprite_ptr(n) + row * 3;
+  uint8_t data[3];
+  for(int i=0 ; i < 3 ; i++)
+    data[i] = mem_->vic_read_byte(addr + i);
+  bool mc = is_multicolor_sprite(n);
+  bool dw = is_double_width_sprite(n);
+  uint32_t key = data[0] | (data[1] << 8) | (data[2] << 16) | 
+    (mc << 24) | (dw << 25) | (1 << 26);
+  SpriteRow &r = sprite_rows_[n];
+  if(r.key == key)
+    return r;
+  r.key = key;
+  std::fill_n(r.mask,4,0);
+  for(int i=0 ; i < 3 ; i++)
   {
-    /* draw background */
-    io_->screen_draw_rect(kGFirstCol,y,kGResX,bgcolor_[0]);
-    /* draw bitmaps */
-    for(int column=0; column < kGCols ; column++)
+    int shift = i * (dw ? 16 : 8);
+    for(int c = (mc ? 1 : 2) ; c <= (mc ? 3 : 2) ; c++)
     {
-      int x = kGFirstCol + column * 8;
-      int line = rstr - kGFirstLine;
-      int row = line/8;
-      int bitmap_row = line % 8;
-      /* retrieve bitmap data */
-      uint8_t data = get_bitmap_data(column,row,bitmap_row);
-      /* retrieve color data */
-      uint8_t scolor = get_screen_char(column,row);
-      uint8_t rcolor = get_char_color(column,row); 
-      /* draw bitmap */
-      if(graphic_mode_ == kBitmapMode)
-        draw_bitmap(x,y,data,scolor);
-      else
-        draw_mcbitmap(x,y,data,scolor,rcolor);
+      uint64_t m = mc ? kPixels.multicolor_mask[data[i]][c] : kPixels.hires_mask[data[i]];
+      if(dw)
+        m = kPixels.wide[m];
+      r.mask[c] |= m << shift;
     }
   }
+  r.mask[0] = r.mask[1] | r.mask[2] | r.mask[3];
+  return r;
 }
 
-void Vic::draw_mcsprite(int x, int y, int sprite, int row)
+/**
+ * @brief foreground pixels of the current line
+ *
+ * Set bits in hires cells and bit pairs %10 and %11 in multicolor 
+ * ones, at the same positions draw_raster_char_mode() and 
+ * draw_raster_bitmap_mode() put them. Only the columns set in 
+ * columns are looked at. Returns false if there are no graphics on 
+ * this line.
+ */
+bool Vic::foreground_mask(uint64_t columns)
 {
-  uint16_t addr = get_sprite_ptr(sprite);
-  for (int i=0; i < 3 ; i++)
+  std::fill_n(fg_,kLineWords,0);
+  int rstr = raster_counter();
+  if((rstr < kGFirstLine) ||
+     (rstr >= kGLastLine) ||
+     is_screen_off())
+    return false;
+  int hscroll = horizontal_scroll();
+  int row = (rstr - kGFirstLine) / 8;
+  int char_row = (rstr - kGFirstLine) % 8;
+  if(row != vm_row_)
+    fetch_video_matrix(row);
+  for( ; columns != 0 ; columns &= columns - 1)
   {
-    uint8_t  data = mem_->vic_read_byte(addr + row * 3 + i);
-    for (int j=0; j < 4; j++)
+    int column = lowest_bit(columns);
+    int x = kGFirstCol + column * 8 + hscroll;
+    uint8_t data;
+    bool mc;
+    switch(graphic_mode_)
     {
-      /* color */
-      uint8_t c = 0;
-      /* color source */
-      uint8_t cs = ((data >> j*2) & 0x3);
-      switch(cs)
-      {
-      /* transparent */
-      case 0:
-        break;
-      case 1:
-        c = sprite_shared_colors_[0];
-        break;
-      case 2:
-        c = sprite_colors_[sprite];
-        break;
-      case 3:
-        c = sprite_shared_colors_[1]; 
-        break;
-      }
-      /* draw if not transparent */
-      if(cs != 0)
-      {
-        io_->screen_update_pixel(
-          x + i*8 + 8 - j * 2,          
-          y,
-          c);
-        io_->screen_update_pixel(
-          x + i*8 + 8 - j * 2 + 1,          
-          y,
-          c);
-      }
+    case kCharMode:
+    case kMCCharMode:
+      /* check 38 cols mode */
+      if(!ISSET_BIT(cr2_,3) && (column == 0 || column == kGCols - 1))
+        continue;
+      data = get_char_data(vm_chars_[column],char_row);
+      mc = graphic_mode_ == kMCCharMode && ISSET_BIT(vm_colors_[column],3);
+      break;
+    case kBitmapMode:
+    case kMCBitmapMode:
+      data = get_bitmap_data(column,row,char_row);
+      mc = graphic_mode_ == kMCBitmapMode;
+      break;
+    default:
+      return false;
+    }
+    if(mc)
+    {
+      const uint8_t *m = kPixels.multicolor_mask[data];
+      set_mask_at(fg_,x + 2,m[2] | m[3]);
     }
-  }      
+    else
+    {
+      uint64_t m = kPixels.hires_mask[data];
+      /* hires cells are clipped, see draw_char() */
+      m &= span(x + 1,0,kGFirstCol + kGResX + 1);
+      set_mask_at(fg_,x + 1,m);
+    }
+  }
+  return true;
 }
 
-void Vic::draw_sprite(int x, int y, int sprite, int row)
+/**
+ * @brief latches collisions in reg, raising irq on the first one
+ */
+void Vic::collision(uint8_t *reg, uint8_t sprites, int irq)
 {
-  int swid = is_double_width_sprite(sprite) ? 2 : 1;
-  uint16_t addr = get_sprite_ptr(sprite);
-  for(int w=0; w < swid ; w++ )
+  if(sprites == 0)
+    return;
+  if(*reg == 0 && ISSET_BIT(irq_enabled_,irq))
   {
-    for (int i=0; i < 3 ; i++)
-    {
-      uint8_t  data = mem_->vic_read_byte(addr + row * 3 + i);
-      for (int j=0; j < 8; j++)
-      {
-        if(ISSET_BIT(data,j))
-        {
-          int new_x = (x+w + (i*8*swid) + (8*swid) - (j*swid)) ;
-          int color = sprite_colors_[sprite];
-          int side_border_offset = 0;
-          int top_border_offset  = 0;
-          int btm_border_offset  = 0;
-          /* check 38 cols mode */
-          if(!ISSET_BIT(cr2_,3))
-            side_border_offset = 8;
-          /* check 24 line mode */
-          if(!ISSET_BIT(cr1_,3))
-          {
-            top_border_offset = 2;
-            btm_border_offset = 4;
-          }
-          /* check bounds */
-          if(new_x <= kGFirstCol+side_border_offset ||
-             y < kGFirstCol + top_border_offset ||
-             new_x > kGResX+kGFirstCol-side_border_offset ||
-             y >= kGResY+kGFirstCol - btm_border_offset)
-            color = border_color_;
-          /* update pixel */
-          io_->screen_update_pixel(
-            new_x,
-            y,
-            color);
-        }
-      }
-    }
+    irq_status_ |= (1 << irq);
+    cpu_->irq_line(true);
+    cpu_->irq();
   }
+  *reg |= sprites;
 }
 
-void Vic::draw_raster_sprites()
+/**
+ * @brief sprites of the current line
+ *
+ * Every sprite on the line is reduced to a row of 64 pixel masks (see
+ * sprite_row()) so collisions are a handful of ANDs: against each 
+ * other and against the foreground of the line. Pixels are then 
+ * claimed in priority order, a background sprite still hides the 
+ * sprites behind it where it is covered by foreground graphics, and 
+ * pixels outside the graphics window are covered by the border.
+ *
+ * Without a line only collisions are detected.
+ */
+void Vic::raster_sprites(uint8_t *line)
 {
-  if(sprite_enabled_ != 0)
+  if(sprite_lines_dirty_)
+    update_sprite_lines();
+  int rstr = raster_counter();
+  uint8_t active = sprite_lines_[rstr];
+  if(active == 0)
+    return;
+  int sp_y = rstr - kSpritesFirstLine;
+  int sprites[8];
+  int x[8];
+  const SpriteRow *rows[8];
+  int count = 0;
+  /* columns under the sprites, cells span 9 pixels past their x */
+  uint64_t columns = 0;
+  int base = kGFirstCol + horizontal_scroll();
+  for(int n=0; n < 8 ; n++)
   {
-    int rstr = raster_counter();
-    int y = rstr - kFirstVisibleLine;
-    int sp_y = rstr - kSpritesFirstLine;
-    /* loop over sprites reverse order */
-    for(int n=7; n >= 0 ; n--)
+    if(!ISSET_BIT(active,n))
+      continue;
+    int row = sp_y - my_[n];
+    if(is_double_height_sprite(n))
+      row /= 2;
+    sprites[count] = n;
+    rows[count] = &sprite_row(n,row);
+    /* hires pixels start one pixel right of the position, like chars */
+    x[count] = kSpritesFirstCol + sprite_x(n) + 
+      ((is_multicolor_sprite(n) || is_double_width_sprite(n)) ? 2 : 1);
+    int width = is_double_width_sprite(n) ? kSpriteWidth * 2 : kSpriteWidth;
+    int first = std::max((x[count] - base - 9) / 8,0);
+    int last = std::min((x[count] + width - base) / 8,kGCols - 1);
+    for(int c = first ; c <= last ; c++)
+      columns |= 1ull << c;
+    count++;
+  }
+  /* collisions */
+  uint8_t ss = 0;
+  uint8_t sb = 0;
+  bool graphics = foreground_mask(columns);
+  for(int i=0 ; i < count ; i++)
+  {
+    uint64_t m = rows[i]->mask[0];
+    for(int j=0 ; j < i ; j++)
     {
-      int height = is_double_height_sprite(n) ? kSpriteHeight * 2 : kSpriteHeight;
-      /* check if the sprite is visible */
-      if(is_sprite_enabled(n) && 
-         sp_y >= my_[n] && 
-         sp_y < my_[n] + height)
-      {
-        int row = sp_y - my_[n];
-        int x = kSpritesFirstCol + sprite_x(n);
-        if(is_double_height_sprite(n))
-        {
-          row = (sp_y - my_[n])/2;
-        }
-        if(is_multicolor_sprite(n))
-        {
-          draw_mcsprite(x,y,n,row);
-        }
-        else
-        {
-          draw_sprite(x,y,n,row);
-        }
-      }
+      if(overlap(m,x[i],rows[j]->mask[0],x[j]))
+        ss |= (1 << sprites[i]) | (1 << sprites[j]);
     }
+    if(graphics && (mask_at(fg_,x[i]) & m) != 0)
+      sb |= (1 << sprites[i]);
   }
+  collision(&sprite_collision_,ss,2);
+  collision(&background_collision_,sb,1);
+  if(line == nullptr)
+    return;
+  /* draw */
+  uint8_t colors[4] = {
+    0,
+    (uint8_t)(sprite_shared_colors_[0] & 0xf),
+    0,
+    (uint8_t)(sprite_shared_colors_[1] & 0xf)};
+  uint8_t border = border_color_ & 0xf;
+  /* graphics window, with 38 cols and 24 rows modes */
+  int side = ISSET_BIT(cr2_,3) ? 0 : 8;
+  int top = ISSET_BIT(cr1_,3) ? 0 : 2;
+  int btm = ISSET_BIT(cr1_,3) ? 0 : 4;
+  bool window_line = rstr >= kGFirstLine + top && rstr < kGLastLine - btm;
+  uint64_t claimed[kLineWords] = {0};
+  for(int i=0 ; i < count ; i++)
+  {
+    int n = sprites[i];
+    const uint64_t *m = rows[i]->mask;
+    uint64_t visible = m[0] & ~mask_at(claimed,x[i]) & 
+      span(x[i],0,kVisibleScreenWidth);
+    set_mask_at(claimed,x[i],m[0]);
+    if(is_background_sprite(n))
+      visible &= ~mask_at(fg_,x[i]);
+    uint64_t inside = 0;
+    if(window_line)
+      inside = span(x[i],kGFirstCol + side + 1,kGFirstCol + kGResX - side + 1);
+    colors[2] = sprite_colors_[n] & 0xf;
+    put_mask(line + x[i],visible & ~inside,border);
+    for(int c=1 ; c <= 3 ; c++)
+      put_mask(line + x[i],visible & inside & m[c],colors[c]);
+  }
+}
+
+// save states ///////////////////////////////////////////////////////////////
+
+/**
+ * @brief copies the chip state out, see C64::save_state()
+ */
+void Vic::save(State *s)
+{
+  std::copy(mx_,mx_+8,s->mx);
+  std::copy(my_,my_+8,s->my);
+  s->msbx = msbx_;
+  s->sprite_enabled = sprite_enabled_;
+  s->sprite_priority = sprite_priority_;
+  s->sprite_multicolor = sprite_multicolor_;
+  s->sprite_double_width = sprite_double_width_;
+  s->sprite_double_height = sprite_double_height_;
+  std::copy(sprite_shared_colors_,sprite_shared_colors_+2,s->sprite_shared_colors);
+  std::copy(sprite_colors_,sprite_colors_+8,s->sprite_colors);
+  s->border_color = border_color_;
+  std::copy(bgcolor_,bgcolor_+4,s->bgcolor);
+  s->next_raster_at = next_raster_at_;
+  s->frame_c = frame_c_;
+  s->cr1 = cr1_;
+  s->cr2 = cr2_;
+  s->raster_c = raster_c_;
+  s->raster_irq = raster_irq_;
+  s->irq_status = irq_status_;
+  s->irq_enabled = irq_enabled_;
+  s->screen_mem = screen_mem_;
+  s->char_mem = char_mem_;
+  s->bitmap_mem = bitmap_mem_;
+  s->mem_pointers = mem_pointers_;
+  s->graphic_mode = graphic_mode_;
+  s->sprite_collision = sprite_collision_;
+  s->background_collision = background_collision_;
+}
+
+/**
+ * @brief restores a state saved with save()
+ */
+void Vic::load(const State &s)
+{
+  std::copy(s.mx,s.mx+8,mx_);
+  std::copy(s.my,s.my+8,my_);
+  msbx_ = s.msbx;
+  sprite_enabled_ = s.sprite_enabled;
+  sprite_priority_ = s.sprite_priority;
+  sprite_multicolor_ = s.sprite_multicolor;
+  sprite_double_width_ = s.sprite_double_width;
+  sprite_double_height_ = s.sprite_double_height;
+  std::copy(s.sprite_shared_colors,s.sprite_shared_colors+2,sprite_shared_colors_);
+  std::copy(s.sprite_colors,s.sprite_colors+8,sprite_colors_);
+  border_color_ = s.border_color;
+  std::copy(s.bgcolor,s.bgcolor+4,bgcolor_);
+  next_raster_at_ = s.next_raster_at;
+  frame_c_ = s.frame_c;
+  cr1_ = s.cr1;
+  cr2_ = s.cr2;
+  raster_c_ = s.raster_c;
+  raster_irq_ = s.raster_irq;
+  irq_status_ = s.irq_status;
+  irq_enabled_ = s.irq_enabled;
+  screen_mem_ = s.screen_mem;
+  char_mem_ = s.char_mem;
+  bitmap_mem_ = s.bitmap_mem;
+  mem_pointers_ = s.mem_pointers;
+  graphic_mode_ = (kGraphicMode)s.graphic_mode;
+  sprite_collision_ = s.sprite_collision;
+  background_collision_ = s.background_collision;
+  vm_row_ = -1;
+  sprite_lines_dirty_ = true;
 }
 
 // helpers ///////////////////////////////////////////////////////////////////
@@ -29,6 +29,15 @@
  * MOS 6569 PAL
  *
  * This class implements the PAL version of the chip
+ *
+ * Sprites are looked up in a per-line list of the sprites covering
+ * each raster line and drawn from row bitmasks, which are also used 
+ * to detect sprite-sprite and sprite-background collisions.
+ *
+ * Rasterizing frames can be skipped, either a fixed number out of 
+ * every few frames or adaptively while the host lags behind real 
+ * time. Everything but the pixels (raster IRQs, bad lines, timing,
+ * sprite collisions) is emulated as usual.
  */
 class Vic
 {
@@ -54,6 +63,13 @@ class Vic
     unsigned int next_raster_at_;
     /* frame counter */
     unsigned int frame_c_;
+    /* frame skipping */
+    unsigned int skip_;
+    unsigned int skip_period_;
+    unsigned int adaptive_skip_;
+    unsigned int skipped_;
+    bool draw_;
+    inline bool draw_frame();
     /* control registers */
     uint8_t cr1_;
     uint8_t cr2_;
@@ -68,6 +84,11 @@ class Vic
     uint16_t char_mem_;
     uint16_t bitmap_mem_;
     uint8_t  mem_pointers_;
+    /* video matrix and color line buffer */
+    uint8_t vm_chars_[40];
+    uint8_t vm_colors_[40];
+    int vm_row_;
+    inline void fetch_video_matrix(int row);
     /* helpers */
     inline void raster_counter(int v);
     inline int raster_counter();
@@ -83,17 +104,11 @@ class Vic
     inline bool is_multicolor_sprite(int n);
     inline int sprite_x(int n);
     /* graphics */ 
-    inline void draw_raster_char_mode();
-    inline void draw_raster_bitmap_mode();
-    inline void draw_raster_sprites();
-    inline void draw_sprite(int x, int y, int sprite, int row);
-    inline void draw_mcsprite(int x, int y, int sprite, int row);
-    inline void draw_char(int x, int y, uint8_t data, uint8_t color);
-    inline void draw_mcchar(int x, int y, uint8_t data, uint8_t color);
-    inline void draw_bitmap(int x, int y, uint8_t data, uint8_t color);
-    inline void draw_mcbitmap(int x, int y, uint8_t data, uint8_t scolor, uint8_t rcolor);
-    inline uint8_t get_screen_char(int column, int row);
-    inline uint8_t get_char_color(int column, int row);
+    inline void draw_raster_char_mode(uint8_t *line);
+    inline void draw_raster_bitmap_mode(uint8_t *line);
+    inline void draw_char(uint8_t *line, int x, uint8_t data, uint8_t color);
+    inline void draw_bitmap(uint8_t *line, int x, uint8_t data, const uint8_t *colors);
+    inline void draw_multicolor(uint8_t *line, int x, uint8_t data, const uint8_t *colors);
     inline uint8_t get_char_data(int chr, int line);
     inline uint8_t get_bitmap_data(int column, int row, int line);
     inline uint16_t get_sprite_ptr(int n);
@@ -101,12 +116,48 @@ class Vic
   public:
     Vic();
     bool emulate();
+    int next_event();
     void memory(Memory *v){mem_ = v;};
     void cpu(Cpu *v){cpu_ = v;};
     void io(IO *v){io_ = v;};
     void write_register(uint8_t r, uint8_t v);
     uint8_t read_register(uint8_t r);
     unsigned int frames(){return frame_c_;};
+    void frame_skip(unsigned int n, unsigned int m){skip_ = n; skip_period_ = m;};
+    void adaptive_skip(unsigned int max){adaptive_skip_ = max;};
+    /* save states */
+    struct State
+    {
+      uint8_t mx[8];
+      uint8_t my[8];
+      uint8_t msbx;
+      uint8_t sprite_enabled;
+      uint8_t sprite_priority;
+      uint8_t sprite_multicolor;
+      uint8_t sprite_double_width;
+      uint8_t sprite_double_height;
+      uint8_t sprite_shared_colors[2];
+      uint8_t sprite_colors[8];
+      uint8_t border_color;
+      uint8_t bgcolor[4];
+      unsigned int next_raster_at;
+      unsigned int frame_c;
+      uint8_t cr1;
+      uint8_t cr2;
+      uint8_t raster_c;
+      int raster_irq;
+      uint8_t irq_status;
+      uint8_t irq_enabled;
+      uint16_t screen_mem;
+      uint16_t char_mem;
+      uint16_t bitmap_mem;
+      uint8_t mem_pointers;
+      uint8_t graphic_mode;
+      uint8_t sprite_collision;
+      uint8_t background_collision;
+    };
+    void save(State *s);
+    void load(const State &s);
     /* constants */
     static const int kScreenLines = 312;
     static const int kScreenCols  = 504;
@@ -118,6 +169,7 @@ class Vic
     static const int kBadLineCycles = 23;
     static constexpr double kRefreshRate = 1 / 50.125; // ~50Hz (PAL)
     static const int kSpritePtrsOffset = 0x3f8;
+    static const unsigned int kAdaptiveSkip = 4;
     /* graphic modes */
     enum kGraphicMode
     {
@@ -143,6 +195,26 @@ class Vic
     static const int kSpriteSize = 64;
     static const int kSpritesFirstLine = 6;
     static const int kSpritesFirstCol = 18;
+  private:
+    /* sprite engine, see raster_sprites() */
+    struct SpriteRow
+    {
+      uint32_t key;
+      uint64_t mask[4];
+    };
+    SpriteRow sprite_rows_[8];
+    uint8_t sprite_lines_[kScreenLines];
+    bool sprite_lines_dirty_;
+    uint8_t sprite_collision_;
+    uint8_t background_collision_;
+    /* foreground pixels of the current line, one bit each */
+    static const int kLineWords = 10;
+    uint64_t fg_[kLineWords];
+    inline void update_sprite_lines();
+    inline const SpriteRow &sprite_row(int n, int row);
+    inline bool foreground_mask(uint64_t columns);
+    inline void collision(uint8_t *reg, uint8_t sprites, int irq);
+    inline void raster_sprites(uint8_t *line);
 };
 
 #endif